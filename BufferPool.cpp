@@ -0,0 +1,107 @@
+////////////////////////////////////////
+// BufferPool.cpp
+////////////////////////////////////////
+
+#include "BufferPool.h"
+
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructor/Destructor
+
+BufferPool::~BufferPool() {
+	Release();
+}
+
+void BufferPool::Release() {
+	for (auto & buffer : _buffers) {
+		if (buffer.id != 0) {
+			glDeleteBuffers(1, &buffer.id);
+		}
+	}
+	_buffers.clear();
+	_allocatedBytes = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Buffers
+
+GLuint BufferPool::Get(unsigned int slot, GLsizeiptr size) {
+
+	if (slot >= _buffers.size()) {
+		_buffers.resize(slot + 1);
+	}
+	PooledBuffer& buffer = _buffers[slot];
+
+	if (buffer.id == 0) {
+		glGenBuffers(1, &buffer.id);
+	}
+
+	// only grow the buffer - keep it sized to the largest request so far
+	if (size > buffer.size) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.id);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		_allocatedBytes += size - buffer.size;
+		_highWaterMark = std::max(_highWaterMark, _allocatedBytes);
+		buffer.size = size;
+	}
+
+	return buffer.id;
+}
+
+GLuint BufferPool::GetCleared(unsigned int slot, GLsizeiptr size, uint32_t value) {
+
+	GLuint id = Get(slot, size);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, id);
+	glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, size, GL_RED_INTEGER, GL_UNSIGNED_INT, &value);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	return id;
+}
+
+GLuint BufferPool::GetWithData(unsigned int slot, GLsizeiptr size, const void* data) {
+
+	GLuint id = Get(slot, size);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, id);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	return id;
+}
+
+GLuint BufferPool::GetReadback(unsigned int slot, GLsizeiptr size) {
+
+	if (slot >= _buffers.size()) {
+		_buffers.resize(slot + 1);
+	}
+	PooledBuffer& buffer = _buffers[slot];
+
+	if (size <= buffer.size) {
+		return buffer.id;
+	}
+
+	// immutable storage can not grow - replace the buffer
+	if (buffer.id != 0) {
+		glDeleteBuffers(1, &buffer.id);
+		_allocatedBytes -= buffer.size;
+	}
+
+	const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &buffer.id);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.id);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+	buffer.mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	_allocatedBytes += size;
+	_highWaterMark = std::max(_highWaterMark, _allocatedBytes);
+	buffer.size = size;
+
+	return buffer.id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
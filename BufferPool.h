@@ -0,0 +1,49 @@
+////////////////////////////////////////
+// BufferPool.h
+// Keeps shader storage buffers alive between calls and only grows them
+////////////////////////////////////////
+
+#pragma once
+
+#include "core.h"
+
+#include <vector>
+
+class BufferPool {
+private:
+
+	struct PooledBuffer {
+		GLuint id = 0;
+		GLsizeiptr size = 0;	// bytes allocated for the buffer
+		void* mapped = nullptr;	// persistent mapping of readback buffers
+	};
+	std::vector<PooledBuffer> _buffers;
+
+	// VRAM Usage
+	GLsizeiptr _allocatedBytes = 0;
+	GLsizeiptr _highWaterMark = 0;
+
+public:
+	BufferPool() {};
+	~BufferPool();
+
+	// Returns the buffer for the slot with at least size bytes, the buffer is only
+	// re-allocated when it is too small and its contents are undefined
+	GLuint Get(unsigned int slot, GLsizeiptr size);
+	// Same as Get but every uint32 in the first size bytes is set to value
+	GLuint GetCleared(unsigned int slot, GLsizeiptr size, uint32_t value = 0);
+	// Same as Get but the first size bytes are copied from data
+	GLuint GetWithData(unsigned int slot, GLsizeiptr size, const void* data);
+
+	// Returns a buffer that stays mapped for reading, only copy into it and read it
+	// through GetMapped once a fence placed after the copy has signaled
+	GLuint GetReadback(unsigned int slot, GLsizeiptr size);
+	void* GetMapped(unsigned int slot)	{ return slot < _buffers.size() ? _buffers[slot].mapped : nullptr; }
+
+	// Delete all of the buffers
+	void Release();
+
+	// Getters
+	GLsizeiptr GetAllocatedBytes()	{ return _allocatedBytes; }
+	GLsizeiptr GetHighWaterMark()	{ return _highWaterMark; }
+};
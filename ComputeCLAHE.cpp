@@ -5,13 +5,11 @@
 #include "ComputeCLAHE.h"
 #include "Shader.h"
 
-#include <thread>
 #include <algorithm>
+#include <cmath>
 
 using namespace std;
 
-void mapHistogram(uint32_t minVal, uint32_t maxVal, uint32_t numPixelsSB, uint32_t numBins, uint32_t* localHist);
-
 ////////////////////////////////////////////////////////////////////////////////
 // Constructors/Destructors
 
@@ -28,9 +26,9 @@ void ComputeCLAHE::Init(GLuint volumeTexture, GLuint maskTexture, glm::ivec3 vol
 	_minMaxShader = LoadComputeShader("minMax.comp");
 	_LUTshader = LoadComputeShader("LUT.comp");
 	_histShader = LoadComputeShader("hist.comp");
-	_excessShader = LoadComputeShader("excess.comp");
-	_clipShaderPass1 = LoadComputeShader("clipHist.comp");
-	_clipShaderPass2 = LoadComputeShader("clipHist_p2.comp");
+	_histMaxShader = LoadComputeShader("histMax.comp");
+	_clipShader = LoadComputeShader("clipHist.comp");
+	_cdfShader = LoadComputeShader("cdf.comp");
 	_lerpShader = LoadComputeShader("lerp.comp");
 	_lerpShader_Focused = LoadComputeShader("lerp_focused.comp");
 
@@ -38,9 +36,8 @@ void ComputeCLAHE::Init(GLuint volumeTexture, GLuint maskTexture, glm::ivec3 vol
 	_minMaxShader_Masked = LoadComputeShader("minMax_masked.comp");
 	_LUTShader_Masked = LoadComputeShader("LUT_masked.comp");
 	_histShader_Masked = LoadComputeShader("hist_masked.comp");
-	_excessShader_Masked = LoadComputeShader("excess_masked.comp");
-	_clipShaderPass1_Masked = LoadComputeShader("clipHist_masked.comp");
-	_clipShaderPass2_Masked = LoadComputeShader("clipHist_p2_masked.comp");
+	_clipShader_Masked = LoadComputeShader("clipHist_masked.comp");
+	_cdfShader_Masked = LoadComputeShader("cdf_masked.comp");
 	_lerpShader_Masked = LoadComputeShader("lerp_masked.comp");
 
 	// Volume Data 
@@ -59,23 +56,20 @@ ComputeCLAHE::~ComputeCLAHE() {
 
 	glDeleteProgram(_histShader);
 	glDeleteProgram(_histShader_Masked);
+	glDeleteProgram(_histMaxShader);
 
-	glDeleteProgram(_excessShader);
-	glDeleteProgram(_clipShaderPass1);
-	glDeleteProgram(_clipShaderPass2);
+	glDeleteProgram(_clipShader);
+	glDeleteProgram(_cdfShader);
 
-	glDeleteProgram(_excessShader_Masked);
-	glDeleteProgram(_clipShaderPass1_Masked);
-	glDeleteProgram(_clipShaderPass2_Masked);
+	glDeleteProgram(_clipShader_Masked);
+	glDeleteProgram(_cdfShader_Masked);
 
 	glDeleteProgram(_lerpShader);
 	glDeleteProgram(_lerpShader_Focused);
 	glDeleteProgram(_lerpShader_Masked);
 
 	// Delete the Buffers 
-	glDeleteBuffers(1, &_LUTbuffer);
-	glDeleteBuffers(1, &_histBuffer);
-	glDeleteBuffers(1, &_histMaxBuffer);
+	_buffers.Release();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -101,14 +95,19 @@ GLuint ComputeCLAHE::Compute3D_CLAHE(glm::uvec3 numSB, float clipLimit) {
 	
 	// Create the LUT
 	uint32_t minMax[2] = { _numInGrayVals, 0 };
-	computeLUT(_volDims, minMax, useLUT);
+	GLsync minMaxFence = computeLUT(_volDims, minMax, useLUT);
+
+	// allocate the new texture while the GPU is busy
+	GLuint newVolumeTexture = createVolumeTexture();
 
 	// Create the Histograms
 	computeHist(_volDims, numSB, useLUT);
-	computeClipHist(_volDims, numSB, clipLimit, minMax);
+	computeClipHist(_volDims, numSB, clipLimit, minMaxFence);
+	printf("Buffer Memory: %.2f MB (high-water mark %.2f MB)\n", _buffers.GetAllocatedBytes() / 1048576.0, 
+			_buffers.GetHighWaterMark() / 1048576.0);
 
 	// Interpolate to create the new texture
-	return computeLerp(_volDims, numSB, useLUT);
+	return computeLerp(_volDims, numSB, useLUT, newVolumeTexture);
 }
 
 // Focused CLAHE
@@ -149,14 +148,19 @@ GLuint ComputeCLAHE::ComputeFocused3D_CLAHE(glm::ivec3 min, glm::ivec3 max, floa
 
 	// Create the LUT
 	uint32_t minMax[2] = { _numInGrayVals, 0 };
-	computeLUT(focusedDim, minMax, useLUT, min);
+	GLsync minMaxFence = computeLUT(focusedDim, minMax, useLUT, min);
+
+	// allocate the new texture while the GPU is busy
+	GLuint newVolumeTexture = createVolumeTexture();
 
 	// Create the Histograms
 	computeHist(focusedDim, numSB, useLUT, min);
-	computeClipHist(focusedDim, numSB, clipLimit, minMax);
+	computeClipHist(focusedDim, numSB, clipLimit, minMaxFence);
+	printf("Buffer Memory: %.2f MB (high-water mark %.2f MB)\n", _buffers.GetAllocatedBytes() / 1048576.0, 
+			_buffers.GetHighWaterMark() / 1048576.0);
 
 	// Interpolate to create the new texture
-	return computeLerp_Focused(focusedDim, numSB, min, max, useLUT);
+	return computeLerp_Focused(focusedDim, numSB, min, max, useLUT, newVolumeTexture);
 }
 
 // Masked CLAHE
@@ -176,38 +180,32 @@ GLuint ComputeCLAHE::ComputeMasked3D_CLAHE(float clipLimit) {
 
 	// Create the LUTs
 	bool useLUT = true; // to spread out the pixel values for the masked organs
-	uint32_t* minData = new uint32_t[_numOrgans];		std::fill_n(minData, _numOrgans, _numInGrayVals);
-	uint32_t* maxData = new uint32_t[_numOrgans];		memset(maxData, 0, _numOrgans * sizeof(uint32_t));
-	uint32_t* numPixels = new uint32_t[_numOrgans];		memset(numPixels, 0, _numOrgans * sizeof(uint32_t));
-	computeLUT_Masked(_volDims, minData, maxData, numPixels);
+	computeLUT_Masked(_volDims);
+
+	// allocate the new texture while the GPU is busy
+	GLuint newVolumeTexture = createVolumeTexture();
 
 	// Create the Histograms 
-	glm::uvec3 numSB = glm::uvec3(1, 1, 1);	// only use 1 SB per organ
 	computeHist_Masked(_volDims, useLUT);
-	computeClipHist_Masked(_volDims, clipLimit, minData, maxData, numPixels);
-	delete[] minData;
-	delete[] maxData;
-	delete[] numPixels;
+	computeClipHist_Masked(clipLimit);
+	printf("Buffer Memory: %.2f MB (high-water mark %.2f MB)\n", _buffers.GetAllocatedBytes() / 1048576.0, 
+			_buffers.GetHighWaterMark() / 1048576.0);
 
 	// Interpolate to re-create the new texture
-	return computeLerp_Masked(_volDims, useLUT);
+	return computeLerp_Masked(_volDims, useLUT, newVolumeTexture);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // CLAHE Compute Shader Functions
 
 // Used for CLAHE and Focused CLAHE
-void ComputeCLAHE::computeLUT(glm::uvec3 volDims, uint32_t* minMax, bool useLUT, glm::uvec3 offset) {
+GLsync ComputeCLAHE::computeLUT(glm::uvec3 volDims, uint32_t* minMax, bool useLUT, glm::uvec3 offset) {
 
 	////////////////////////////////////////////////////////////////////////////
 	// Calculate the Min/Max Values for the volume 
 
 	// buffer to store the min/max
-	GLuint globalMinMaxBuffer;
-	glGenBuffers(1, &globalMinMaxBuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, globalMinMaxBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(uint32_t), minMax, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	GLuint globalMinMaxBuffer = _buffers.GetWithData(MIN_MAX_BUFFER, 2 * sizeof(uint32_t), minMax);
 	
 	// Set up Compute Shader 
 	glUseProgram(_minMaxShader);
@@ -219,32 +217,19 @@ void ComputeCLAHE::computeLUT(glm::uvec3 volDims, uint32_t* minMax, bool useLUT,
 	glDispatchCompute(	(GLuint)((volDims.x + 3) / 4),
 						(GLuint)((volDims.y + 3) / 4),
 						(GLuint)((volDims.z + 3) / 4));
-	// make sure writting to the image is finished before reading 
-	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	// make sure writting to the min/max is finished before reading 
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 	glUseProgram(0);
 
-
-	// Store the calculated global Min and Max data
-	uint32_t* data = new uint32_t[2];
-	memset(data, 0, 2 * sizeof(uint32_t));
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, globalMinMaxBuffer);
-	data = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-
-	minMax[0] = data[0], minMax[1] = data[1];
-
-	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	// Read back the calculated global Min and Max data once the GPU gets to it
+	GLsync minMaxFence = queueReadback(globalMinMaxBuffer, MIN_MAX_READBACK, 2 * sizeof(uint32_t));
 
 
 	////////////////////////////////////////////////////////////////////////////
 	// Compute the LUT
 
 	// buffer to store the LUT
-	glGenBuffers(1, &_LUTbuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _LUTbuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, _numInGrayVals * sizeof(uint32_t), nullptr, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	_LUTbuffer = _buffers.Get(LUT_BUFFER, _numInGrayVals * sizeof(uint32_t));
 
 	if (useLUT) {
 		// Set up Compute Shader 
@@ -259,40 +244,21 @@ void ComputeCLAHE::computeLUT(glm::uvec3 volDims, uint32_t* minMax, bool useLUT,
 		glUseProgram(0);
 	}
 
-	// clean up
-	glDeleteBuffers(1, &globalMinMaxBuffer);
+	return minMaxFence;
 }
 // Used for Masked CLAHE
-void ComputeCLAHE::computeLUT_Masked(glm::uvec3 volDims, uint32_t* minData, uint32_t* maxData, uint32_t* pixelCount) {
+void ComputeCLAHE::computeLUT_Masked(glm::uvec3 volDims) {
 	
 	////////////////////////////////////////////////////////////////////////////
 	// Calculate the Min/Max Values for the volume 
 
 	// buffer to store the min/max
-	GLuint globalMinBuffer;
-	uint32_t* tempMinData = new uint32_t[_numOrgans];
-	std::fill_n(tempMinData, _numOrgans, _numInGrayVals);
-	glGenBuffers(1, &globalMinBuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, globalMinBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, _numOrgans * sizeof(uint32_t), tempMinData, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-	GLuint globalMaxBuffer;
-	uint32_t* tempMaxData = new uint32_t[_numOrgans];	
-	memset(tempMaxData, 0, _numOrgans * sizeof(uint32_t));
-	glGenBuffers(1, &globalMaxBuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, globalMaxBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, _numOrgans * sizeof(uint32_t), tempMaxData, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	GLsizeiptr organsSize = _numOrgans * sizeof(uint32_t);
+	GLuint globalMinBuffer = _buffers.GetCleared(MIN_BUFFER, organsSize, _numInGrayVals);
+	GLuint globalMaxBuffer = _buffers.GetCleared(MAX_BUFFER, organsSize, 0);
 
 	// buffer to count the number of pixels that are not masked
-	GLuint unMaskedPixelBuffer;
-	uint32_t* tempPixelCount = new uint32_t[_numOrgans];
-	memset(tempPixelCount, 0, _numOrgans * sizeof(uint32_t));
-	glGenBuffers(1, &unMaskedPixelBuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, unMaskedPixelBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, _numOrgans * sizeof(uint32_t), tempPixelCount, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	GLuint unMaskedPixelBuffer = _buffers.GetCleared(PIXEL_COUNT_BUFFER, organsSize, 0);
 
 	// Set up Compute Shader 
 	glUseProgram(_minMaxShader_Masked);
@@ -306,45 +272,17 @@ void ComputeCLAHE::computeLUT_Masked(glm::uvec3 volDims, uint32_t* minData, uint
 	glDispatchCompute(	(GLuint)((volDims.x + 3) / 4),
 						(GLuint)((volDims.y + 3) / 4),
 						(GLuint)((volDims.z + 3) / 4));
-	// make sure writting to the image is finished before reading 
-	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	// make sure writting to the min/max is finished before reading 
+	// - the min/max values and pixel counts stay on the GPU
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	glUseProgram(0);
 
 
-	// Store the calculated global Min and Max data
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, globalMinBuffer);
-	tempMinData = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, globalMaxBuffer);
-	tempMaxData = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-	for (int i = 0; i < _numOrgans; i++) {
-		minData[i] = tempMinData[i];
-		maxData[i] = tempMaxData[i];
-	}
-
-	// Get the num Pixels in the masked region
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, unMaskedPixelBuffer);
-	tempPixelCount = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-	for (int i = 0; i < _numOrgans; i++) {
-		pixelCount[i] = tempPixelCount[i];
-	}
-
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
-
-
 	////////////////////////////////////////////////////////////////////////////
 	// Compute the LUT
 
 	// buffer to store the LUT
-	glGenBuffers(1, &_LUTbuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _LUTbuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, _numInGrayVals * _numOrgans * sizeof(uint32_t), nullptr, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	_LUTbuffer = _buffers.Get(LUT_BUFFER, _numInGrayVals * _numOrgans * sizeof(uint32_t));
 
 	// Set up Compute Shader 
 	glUseProgram(_LUTShader_Masked);
@@ -359,10 +297,6 @@ void ComputeCLAHE::computeLUT_Masked(glm::uvec3 volDims, uint32_t* minData, uint
 
 	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	glUseProgram(0);
-
-	// clean up
-	glDeleteBuffers(1, &globalMinBuffer);
-	glDeleteBuffers(1, &globalMaxBuffer);
 }
 
 // Used for CLAHE and Focused CLAHE
@@ -370,57 +304,43 @@ void ComputeCLAHE::computeHist(glm::uvec3 volDims, glm::uvec3 numSB, bool useLUT
 	
 	// Buffer to store the Histograms
 	uint32_t histSize = _numOutGrayVals * numSB.x * numSB.y * numSB.z;
-	glGenBuffers(1, &_histBuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _histBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, histSize * sizeof(uint32_t), nullptr, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	_histBuffer = _buffers.GetCleared(HIST_BUFFER, histSize * sizeof(uint32_t), 0);
 	
-	glGenBuffers(1, &_histMaxBuffer);
-	uint32_t maxValSize = numSB.x * numSB.y * numSB.z;
-	uint32_t* _histMax = new uint32_t[maxValSize];
-	memset(_histMax, 0, maxValSize * sizeof(uint32_t));
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _histMaxBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, maxValSize * sizeof(uint32_t), _histMax, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
 	// Set up Compute Shader 
 	glUseProgram(_histShader);
 	glBindImageTexture(0, _volumeTexture, 0, GL_TRUE, _layer, GL_READ_ONLY, GL_R16UI);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _LUTbuffer);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _histBuffer);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, _histMaxBuffer);
 	glUniform3i(glGetUniformLocation(_histShader, "numSB"), numSB.x, numSB.y, numSB.z);
 	glUniform1ui(glGetUniformLocation(_histShader, "NUM_OUT_BINS"), _numOutGrayVals);
 	glUniform3ui(glGetUniformLocation(_histShader, "offset"), offset.x, offset.y, offset.z);
 	glUniform1i(glGetUniformLocation(_histShader, "useLUT"), useLUT);
 	glUniform3ui(glGetUniformLocation(_histShader, "volumeDims"), volDims.x, volDims.y, volDims.z);
 
-	glDispatchCompute(	(GLuint)((volDims.x + 3) / 4),
-						(GLuint)((volDims.y + 3) / 4),
-						(GLuint)((volDims.z + 3) / 4));
+	// each work group covers an 8x8x8 brick of a single sub block, enough work groups
+	// are dispatched per sub block to cover the last one - which absorbs the remainder
+	glm::uvec3 sizeSB = volDims / numSB;
+	glm::uvec3 lastSB = volDims - (numSB - glm::uvec3(1)) * sizeSB;
+	glm::uvec3 groupsPerSB = (lastSB + glm::uvec3(7)) / glm::uvec3(8);
+	glUniform3ui(glGetUniformLocation(_histShader, "groupsPerSB"), groupsPerSB.x, groupsPerSB.y, groupsPerSB.z);
 
-	// make sure writting to the image is finished before reading 
-	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	glDispatchCompute(	(GLuint)(numSB.x * groupsPerSB.x),
+						(GLuint)(numSB.y * groupsPerSB.y),
+						(GLuint)(numSB.z * groupsPerSB.z));
+
+	// make sure writting to the histograms is finished before reading 
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	glUseProgram(0);
+
+	// Find the max value of each of the histograms
+	computeHistMax(numSB.x * numSB.y * numSB.z);
 }
 // Used for Masked CLAHE
 void ComputeCLAHE::computeHist_Masked(glm::uvec3 volDims, bool useLUT) {
 	
 	// Buffer to store the Histograms
 	uint32_t histSize = _numOutGrayVals * _numOrgans;
-	glGenBuffers(1, &_histBuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _histBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, histSize * sizeof(uint32_t), nullptr, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-	// Buffer to store the max values of the histograms
-	uint32_t maxValSize = _numOrgans;
-	uint32_t* _histMax = new uint32_t[maxValSize];
-	memset(_histMax, 0, maxValSize * sizeof(uint32_t));
-	glGenBuffers(1, &_histMaxBuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _histMaxBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, maxValSize * sizeof(uint32_t), _histMax, GL_STREAM_READ);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	_histBuffer = _buffers.GetCleared(HIST_BUFFER, histSize * sizeof(uint32_t), 0);
 
 	// Set up Compute Shader 
 	glUseProgram(_histShader_Masked);
@@ -428,8 +348,8 @@ void ComputeCLAHE::computeHist_Masked(glm::uvec3 volDims, bool useLUT) {
 	glBindImageTexture(1, _maskTexture, 0, GL_TRUE, _layer, GL_READ_ONLY, GL_R8UI);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _LUTbuffer);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, _histBuffer);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, _histMaxBuffer);
-	glUniform1ui(glGetUniformLocation(_histShader_Masked, "NUM_BINS"), _numInGrayVals);
+	glUniform1ui(glGetUniformLocation(_histShader_Masked, "NUM_IN_BINS"), _numInGrayVals);
+	glUniform1ui(glGetUniformLocation(_histShader_Masked, "NUM_OUT_BINS"), _numOutGrayVals);
 	glUniform1i(glGetUniformLocation(_histShader_Masked, "useLUT"), useLUT);
 	glUniform3ui(glGetUniformLocation(_histShader_Masked, "volumeDims"), volDims.x, volDims.y, volDims.z);
 
@@ -437,324 +357,150 @@ void ComputeCLAHE::computeHist_Masked(glm::uvec3 volDims, bool useLUT) {
 						(GLuint)((volDims.y + 3) / 4),
 						(GLuint)((volDims.z + 3) / 4));
 
-	// make sure writting to the image is finished before reading 
-	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	// make sure writting to the histograms is finished before reading 
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(0);
+
+	// Find the max value of each of the histograms
+	computeHistMax(_numOrgans);
+}
+// Used for CLAHE, Focused CLAHE and Masked CLAHE
+void ComputeCLAHE::computeHistMax(uint32_t numHistograms) {
+
+	// Buffer to store the max values of the histograms
+	_histMaxBuffer = _buffers.Get(HIST_MAX_BUFFER, numHistograms * sizeof(uint32_t));
+
+	// Set up Compute Shader - one work group per histogram
+	glUseProgram(_histMaxShader);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _histMaxBuffer);
+	glUniform1ui(glGetUniformLocation(_histMaxShader, "NUM_BINS"), _numOutGrayVals);
+
+	glDispatchCompute(numHistograms, 1, 1);
+
+	// make sure writting to the max values is finished before reading 
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	glUseProgram(0);
 }
 
 // Used for CLAHE and Focused CLAHE
-void ComputeCLAHE::computeClipHist(glm::uvec3 volDims, glm::uvec3 numSB, float clipLimit, uint32_t* minMax, int numPixels) {
+void ComputeCLAHE::computeClipHist(glm::uvec3 volDims, glm::uvec3 numSB, float clipLimit, GLsync minMaxFence) {
 
-	uint32_t histSize = _numOutGrayVals * numSB.x * numSB.y * numSB.z;
 	uint32_t numHistograms = numSB.x * numSB.y * numSB.z;
 
+	// number of pixels in each Sub Block, the last one on each axis absorbs the remainder
+	glm::uvec3 sizeSB = volDims / numSB;
+	glm::uvec3 lastSB = volDims - (numSB - glm::uvec3(1)) * sizeSB;
+	uint32_t* numPixels = new uint32_t[numHistograms];
+	for (unsigned int z = 0; z < numSB.z; z++) {
+		for (unsigned int y = 0; y < numSB.y; y++) {
+			for (unsigned int x = 0; x < numSB.x; x++) {
+				glm::uvec3 currSB = glm::uvec3(	(x == numSB.x - 1) ? lastSB.x : sizeSB.x,
+												(y == numSB.y - 1) ? lastSB.y : sizeSB.y,
+												(z == numSB.z - 1) ? lastSB.z : sizeSB.z);
+				numPixels[(z * numSB.y + y) * numSB.x + x] = currSB.x * currSB.y * currSB.z;
+			}
+		}
+	}
+	GLuint pixelCountBuffer = _buffers.GetWithData(PIXEL_COUNT_BUFFER, numHistograms * sizeof(uint32_t), numPixels);
+	delete[] numPixels;
+
 	if (clipLimit < 1.0f) {
 
 		////////////////////////////////////////////////////////////////////////////
-		// Calculate the excess pixels based on the clipLimit
-		
-		// buffer for the pixels to re-distribute
-		GLuint excessBuffer;
-		uint32_t* excess = new uint32_t[numHistograms];
-		memset(excess, 0, numHistograms * sizeof(uint32_t));
-		glGenBuffers(1, &excessBuffer);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, excessBuffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, numHistograms * sizeof(uint32_t), excess, GL_STREAM_READ);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-		delete[] excess;
-
-		// calculate the minClipValue
-		glm::uvec3 sizeSB = volDims / numSB;
-		float tempClipValue = 1.1f * (sizeSB.x * sizeSB.y * sizeSB.z) / _numOutGrayVals;
-		unsigned int minClipValue = unsigned int(tempClipValue + 0.5f);
+		// Clip the Histograms and re-distribute the excess pixels
+		// - one work group per histogram loops until all of the excess is handed out,
+		//   the minClipValues come from the pixel counts of each Sub Block
 
 		// Set up Compute Shader 
-		glUseProgram(_excessShader);
+		glUseProgram(_clipShader);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _histMaxBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, excessBuffer);
-		glUniform1ui(glGetUniformLocation(_excessShader, "NUM_BINS"), _numOutGrayVals);
-		glUniform1f(glGetUniformLocation(_excessShader, "clipLimit"), clipLimit);
-		glUniform1ui(glGetUniformLocation(_excessShader, "minClipValue"), minClipValue);
-
-		int width = 4096;
-		int count = (histSize + 63) / 64;
-		GLuint dispatchWidth = count / (width*width);
-		GLuint dispatchHeight = (count / width) % width;
-		GLuint dispatchDepth = count % width;
-		glDispatchCompute(dispatchWidth, dispatchHeight, dispatchDepth);
-
-		// make sure writting to the image is finished before reading 
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-		glUseProgram(0);
-
-		////////////////////////////////////////////////////////////////////////////
-		// Clip the Histogram - Pass 1 
-		// - clip the values and re-distribute to all pixels
-
-		glUseProgram(_clipShaderPass1);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _histMaxBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, excessBuffer);
-		glUniform1ui(glGetUniformLocation(_clipShaderPass1, "NUM_BINS"), _numOutGrayVals);
-		glUniform1f(glGetUniformLocation(_clipShaderPass1, "clipLimit"), clipLimit);
-		glUniform1ui(glGetUniformLocation(_clipShaderPass1, "minClipValue"), minClipValue);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, pixelCountBuffer);
+		glUniform1ui(glGetUniformLocation(_clipShader, "NUM_BINS"), _numOutGrayVals);
+		glUniform1f(glGetUniformLocation(_clipShader, "clipLimit"), clipLimit);
 
-		glDispatchCompute(dispatchWidth, dispatchHeight, dispatchDepth);
+		glDispatchCompute(numHistograms, 1, 1);
 
-		// make sure writting to the image is finished before reading 
+		// make sure writting to the histograms is finished before reading 
 		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 		glUseProgram(0);
-
-		////////////////////////////////////////////////////////////////////////////
-		// Clip the Histogram - Pass 2 
-		// - redistribute any remaining excess pixels throughout the image
-
-		// Get the excess pixels
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, excessBuffer);
-		excess = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-		// compute stepSize for the second pass of redistributing the excess pixels
-		uint32_t* stepSize = new uint32_t[numHistograms];
-		memset(stepSize, 0, numHistograms * sizeof(uint32_t));
-		bool computePass2 = false;
-		for (unsigned int i = 0; i < numHistograms; i++) {
-			if (excess[i] == 0) {
-				stepSize[i] = 0;
-			}
-			else {
-				stepSize[i] = std::max(_numInGrayVals / excess[i], 1u);
-				computePass2 = true;
-			}
-		}
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
-
-		// if there were any excess pixels left
-		if (computePass2) {
-			GLuint stepSizeBuffer;
-			glGenBuffers(1, &stepSizeBuffer);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, stepSizeBuffer);
-			glBufferData(GL_SHADER_STORAGE_BUFFER, numHistograms * sizeof(uint32_t), stepSize, GL_STREAM_READ);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-			glUseProgram(_clipShaderPass2);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _histMaxBuffer);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, excessBuffer);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, stepSizeBuffer);
-			glUniform1ui(glGetUniformLocation(_clipShaderPass2, "NUM_BINS"), _numOutGrayVals);
-			glUniform1f(glGetUniformLocation(_clipShaderPass2, "clipLimit"), clipLimit);
-			glUniform1ui(glGetUniformLocation(_clipShaderPass2, "minClipValue"), minClipValue);
-
-			glDispatchCompute((GLuint)((histSize + 63) / 64), 1, 1);
-
-			// make sure writting to the image is finished before reading 
-			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-			glUseProgram(0);
-
-			glDeleteBuffers(1, &stepSizeBuffer);
-		}
-
-		delete[] stepSize;
-		glDeleteBuffers(1, &excessBuffer);
 	}
 
 	////////////////////////////////////////////////////////////////////////////
 	// Map the histograms 
 	// - calculate the CDF for each of the histograms and store it in hist
 
-	unsigned int numPixelsSB;
-	if (numPixels == -1) {
-		glm::vec3 sizeSB = volDims / numSB;
-		numPixelsSB = sizeSB.x * sizeSB.y * sizeSB.z;
-	}
-	else {
-		numPixelsSB = numPixels;
-	}
-
-	uint32_t* hist = new uint32_t[histSize];
-	memset(hist, 0, histSize * sizeof(uint32_t));
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _histBuffer);
-	hist = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE);
+	// the min/max are needed to normalize the CDFs
+	uint32_t* minMax = waitReadback(minMaxFence, MIN_MAX_READBACK);
 
-	std::vector<std::thread> threads;
-	for (unsigned int currHistIndex = 0; currHistIndex < numHistograms; currHistIndex++) {
-		uint32_t* currHist = &hist[currHistIndex * _numOutGrayVals];
-		threads.push_back(std::thread(mapHistogram, minMax[0], minMax[1], numPixelsSB, _numOutGrayVals, currHist));
-	}
-	for (auto & currThread : threads) {
-		currThread.join();
-	}
+	// Set up Compute Shader - one work group per histogram
+	glUseProgram(_cdfShader);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, pixelCountBuffer);
+	glUniform1ui(glGetUniformLocation(_cdfShader, "NUM_BINS"), _numOutGrayVals);
+	glUniform1ui(glGetUniformLocation(_cdfShader, "minVal"), minMax[0]);
+	glUniform1ui(glGetUniformLocation(_cdfShader, "maxVal"), minMax[1]);
 
-	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	glDispatchCompute(numHistograms, 1, 1);
 
+	// make sure the CDFs are finished before the lerp reads them
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(0);
 }
 // Used for Masked CLAHE
-void ComputeCLAHE::computeClipHist_Masked(glm::uvec3 volDims, float clipLimit, uint32_t* min, uint32_t* max, uint32_t* numPixels) {
+void ComputeCLAHE::computeClipHist_Masked(float clipLimit) {
 
-	uint32_t histSize = _numOutGrayVals;
 	uint32_t numHistograms = _numOrgans;
 
+	// the min/max/pixel counts are still in the buffers from computeLUT_Masked
+	GLsizeiptr organsSize = numHistograms * sizeof(uint32_t);
+	GLuint globalMinBuffer = _buffers.Get(MIN_BUFFER, organsSize);
+	GLuint globalMaxBuffer = _buffers.Get(MAX_BUFFER, organsSize);
+	GLuint unMaskedPixelBuffer = _buffers.Get(PIXEL_COUNT_BUFFER, organsSize);
+
 	if (clipLimit < 1.0f) {
 		////////////////////////////////////////////////////////////////////////////
-		// Calculate the excess pixels based on the clipLimit
-
-		// buffer for the pixels to re-distribute
-		GLuint excessBuffer;
-		uint32_t* excess = new uint32_t[numHistograms];
-		memset(excess, 0, numHistograms * sizeof(uint32_t));
-		glGenBuffers(1, &excessBuffer);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, excessBuffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, numHistograms * sizeof(uint32_t), excess, GL_STREAM_READ);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-		delete[] excess;
-
-		GLuint minClipValueBuffer;
-		// calculate the minClipValues for each Organ
-		uint32_t* minClipValues = new uint32_t[_numOrgans];		
-		memset(minClipValues, 0, _numOrgans * sizeof(uint32_t));
-		for (int i = 0; i < _numOrgans; i++) {
-			float tempClipValue = 1.1f * numPixels[i] / _numOutGrayVals;
-			minClipValues[i] = unsigned int(tempClipValue + 0.5f);
-		}
-		glGenBuffers(1, &minClipValueBuffer);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, minClipValueBuffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, numHistograms * sizeof(uint32_t), minClipValues, GL_STREAM_READ);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		// Clip the Histograms and re-distribute the excess pixels
+		// - one work group per organ loops until all of the excess is handed out,
+		//   the minClipValues come from the pixel counts of each organ
 
 		// Set up Compute Shader 
-		glUseProgram(_excessShader_Masked);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _histMaxBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, minClipValueBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, excessBuffer);
-		glUniform1ui(glGetUniformLocation(_excessShader_Masked, "NUM_BINS"), _numOutGrayVals);
-		glUniform1f(glGetUniformLocation(_excessShader_Masked, "clipLimit"), clipLimit);
-
-		glDispatchCompute((GLuint)((histSize + 63) / 64), 1, 1);
-
-		// make sure writting to the image is finished before reading 
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-		glUseProgram(0);
-
-		////////////////////////////////////////////////////////////////////////////
-		// Clip the Histogram - Pass 1 
-		// - clip the values and re-distribute some to all pixels
-		
-		glUseProgram(_clipShaderPass1_Masked);
+		glUseProgram(_clipShader_Masked);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _histMaxBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, excessBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, minClipValueBuffer);
-		glUniform1ui(glGetUniformLocation(_clipShaderPass1_Masked, "NUM_BINS"), _numOutGrayVals);
-		glUniform1f(glGetUniformLocation(_clipShaderPass1_Masked, "clipLimit"), clipLimit);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, unMaskedPixelBuffer);
+		glUniform1ui(glGetUniformLocation(_clipShader_Masked, "NUM_BINS"), _numOutGrayVals);
+		glUniform1f(glGetUniformLocation(_clipShader_Masked, "clipLimit"), clipLimit);
 
-		glDispatchCompute((GLuint)((histSize + 63) / 64), 1, 1);
+		glDispatchCompute(numHistograms, 1, 1);
 
-		// make sure writting to the image is finished before reading 
+		// make sure writting to the histograms is finished before reading 
 		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 		glUseProgram(0);
-
-		////////////////////////////////////////////////////////////////////////////
-		// Clip the Histogram - Pass 2 
-		// - redistribute the remaining excess pixels throughout the image
-
-		// Get the excess pixels
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, excessBuffer);
-		excess = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-		// compute stepSize for the second pass of redistributing the excess pixels
-		uint32_t* stepSize = new uint32_t[numHistograms];
-		memset(stepSize, 0, numHistograms * sizeof(uint32_t));
-		bool computePass2 = false;
-		for (unsigned int i = 0; i < numHistograms; i++) {
-			if (excess[i] == 0) {
-				stepSize[i] = 0;
-			}
-			else {
-				stepSize[i] = std::max(_numInGrayVals / excess[i], 1u);
-				computePass2 = true;
-			}
-		}
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
-
-		if (computePass2) {
-			GLuint stepSizeBuffer;
-			glGenBuffers(1, &stepSizeBuffer);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, stepSizeBuffer);
-			glBufferData(GL_SHADER_STORAGE_BUFFER, numHistograms * sizeof(uint32_t), stepSize, GL_STREAM_READ);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-			glUseProgram(_clipShaderPass2_Masked);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _histMaxBuffer);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, excessBuffer);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, minClipValueBuffer);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, stepSizeBuffer);
-			glUniform1ui(glGetUniformLocation(_clipShaderPass2_Masked, "NUM_BINS"), _numOutGrayVals);
-			glUniform1f(glGetUniformLocation(_clipShaderPass2_Masked, "clipLimit"), clipLimit);
-
-
-			glDispatchCompute((GLuint)((histSize + 63) / 64), 1, 1);
-
-			// make sure writting to the image is finished before reading 
-			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-			glUseProgram(0);
-
-			glDeleteBuffers(1, &stepSizeBuffer);
-		}
-
-		//delete[] excess;
-		delete[] stepSize;
-		delete[] minClipValues;
-		glDeleteBuffers(1, &excessBuffer);
 	}
 
 	////////////////////////////////////////////////////////////////////////////
 	// Map the histograms 
 	// - calculate the CDF for each of the histograms and store it in hist
 
+	// Set up Compute Shader - one work group per organ
+	glUseProgram(_cdfShader_Masked);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _histBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, globalMinBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, globalMaxBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, unMaskedPixelBuffer);
+	glUniform1ui(glGetUniformLocation(_cdfShader_Masked, "NUM_BINS"), _numOutGrayVals);
 
-	uint32_t* hist = new uint32_t[histSize];
-	memset(hist, 0, histSize * sizeof(uint32_t));
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _histBuffer);
-	hist = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE);
-	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-	std::vector<std::thread> threads;
-	for (unsigned int currHistIndex = 0; currHistIndex < numHistograms; currHistIndex++) {
+	glDispatchCompute(numHistograms, 1, 1);
 
-		uint32_t* currHist = &hist[currHistIndex * _numOutGrayVals];
-		uint32_t currMin = min[currHistIndex];
-		uint32_t currMax = max[currHistIndex];
-		uint32_t currPixelCount = numPixels[currHistIndex];
-
-		threads.push_back(std::thread(mapHistogram, currMin, currMax, currPixelCount, _numOutGrayVals, currHist));
-	}
-	for (auto & currThread : threads) {
-		currThread.join();
-	}
-
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	// make sure the CDFs are finished before the lerp reads them
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(0);
 }
 
 // Used for CLAHE
-GLuint ComputeCLAHE::computeLerp(glm::uvec3 volDims, glm::uvec3 numSB, bool useLUT, glm::uvec3 offset) {
-
-	// generate the new volume texture
-	GLuint newVolumeTexture;
-	glGenTextures(1, &newVolumeTexture);
-	glBindTexture(GL_TEXTURE_3D, newVolumeTexture);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexStorage3D(GL_TEXTURE_3D, 1, GL_R16F, _volDims.x, _volDims.y, _volDims.z);
-	glBindTexture(GL_TEXTURE_3D, 0);
+GLuint ComputeCLAHE::computeLerp(glm::uvec3 volDims, glm::uvec3 numSB, bool useLUT, GLuint newVolumeTexture, glm::uvec3 offset) {
 
 	// Set up Compute Shader 
 	glUseProgram(_lerpShader);
@@ -778,20 +524,9 @@ GLuint ComputeCLAHE::computeLerp(glm::uvec3 volDims, glm::uvec3 numSB, bool useL
 	return newVolumeTexture;
 }
 // Used for Focused CLAHE
-GLuint ComputeCLAHE::computeLerp_Focused(glm::uvec3 volDims, glm::uvec3 numSB, glm::uvec3 minVal, glm::vec3 maxVal, bool useLUT) {
+GLuint ComputeCLAHE::computeLerp_Focused(glm::uvec3 volDims, glm::uvec3 numSB, glm::uvec3 minVal, glm::vec3 maxVal, bool useLUT, 
+										GLuint newVolumeTexture) {
 
-	// generate the new volume texture
-	GLuint newVolumeTexture;
-	glGenTextures(1, &newVolumeTexture);
-	glBindTexture(GL_TEXTURE_3D, newVolumeTexture);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexStorage3D(GL_TEXTURE_3D, 1, GL_R16F, _volDims.x, _volDims.y, _volDims.z);
-	glBindTexture(GL_TEXTURE_3D, 0);
-	
 	// Set up Compute Shader 
 	glUseProgram(_lerpShader_Focused);
 	glBindImageTexture(0, _volumeTexture, 0, GL_TRUE, _layer, GL_READ_ONLY, GL_R16UI);
@@ -816,20 +551,8 @@ GLuint ComputeCLAHE::computeLerp_Focused(glm::uvec3 volDims, glm::uvec3 numSB, g
 	return newVolumeTexture;
 }
 // Used for Masked CLAHE
-GLuint ComputeCLAHE::computeLerp_Masked(glm::uvec3 volDims, bool useLUT) {
+GLuint ComputeCLAHE::computeLerp_Masked(glm::uvec3 volDims, bool useLUT, GLuint newVolumeTexture) {
 	
-	// generate the new volume texture
-	GLuint newVolumeTexture;
-	glGenTextures(1, &newVolumeTexture);
-	glBindTexture(GL_TEXTURE_3D, newVolumeTexture);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexStorage3D(GL_TEXTURE_3D, 1, GL_R16F, _volDims.x, _volDims.y, _volDims.z);
-	glBindTexture(GL_TEXTURE_3D, 0);
-
 	// Set up Compute Shader 
 	glUseProgram(_lerpShader_Masked);
 	glBindImageTexture(0, _volumeTexture, 0, GL_TRUE, _layer, GL_READ_ONLY, GL_R16UI);
@@ -854,22 +577,72 @@ GLuint ComputeCLAHE::computeLerp_Masked(glm::uvec3 volDims, bool useLUT) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Helper Method - multi-thread map hist across each histogram 
+// Helper Method - Number of Histogram Bins
+
+// bitsStored - BitsStored of the DICOM data
+// minVal/maxVal - measured range of the stored values
+// maxBins - largest number of bins to use (ie. 4096 or 1024)
+// Returns the number of output gray values (histogram bins) needed for the data
+unsigned int ComputeCLAHE::GetNumBins(unsigned int bitsStored, double minVal, double maxVal, unsigned int maxBins) {
+
+	// no more bins than the data can hold or the 16 bit volume texture can represent
+	double numBins = std::min(std::pow(2.0, (double)std::min(bitsStored, 16u)), 65536.0);
+	if (maxVal > minVal) {
+		numBins = std::min(numBins, std::floor(maxVal - minVal) + 1.0);
+	}
+	numBins = std::min(numBins, (double)maxBins);
 
-void mapHistogram(uint32_t minVal, uint32_t maxVal, uint32_t numPixelsSB, uint32_t numBins, uint32_t* localHist) {
+	return std::max((unsigned int)numBins, 2u);
+}
 
-	float sum = 0;
-	const float scale = ((float)(maxVal - minVal)) / (float)numPixelsSB;
+////////////////////////////////////////////////////////////////////////////////
+// Helper Methods - Output Texture and Readbacks
 
-	// for each bin
-	for (unsigned int i = 0; i < numBins; i++) {
+GLuint ComputeCLAHE::createVolumeTexture() {
 
-		// add the histogram value for this contextual region to the sum 
-		sum += localHist[i];
+	// generate the new volume texture
+	GLuint newVolumeTexture;
+	glGenTextures(1, &newVolumeTexture);
+	glBindTexture(GL_TEXTURE_3D, newVolumeTexture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexStorage3D(GL_TEXTURE_3D, 1, GL_R16F, _volDims.x, _volDims.y, _volDims.z);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	return newVolumeTexture;
+}
+
+// Copies the buffer into the persistent mapped readback slot, the caller must have 
+// issued a GL_BUFFER_UPDATE_BARRIER_BIT barrier after the shader wrote srcBuffer
+GLsync ComputeCLAHE::queueReadback(GLuint srcBuffer, BufferSlot slot, GLsizeiptr size) {
+
+	GLuint readbackBuffer = _buffers.GetReadback(slot, size);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, srcBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
-		// normalize the cdf
-		localHist[i] = (unsigned int)(min(minVal + sum * scale, (float)maxVal));
+	return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Blocks until the copy behind the fence is done and returns the mapped data
+uint32_t* ComputeCLAHE::waitReadback(GLsync fence, BufferSlot slot) {
+
+	GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	while (result == GL_TIMEOUT_EXPIRED) {
+		result = glClientWaitSync(fence, 0, 1000000000);
 	}
+	if (result == GL_WAIT_FAILED) {
+		printf("Readback fence wait failed\n");
+	}
+	glDeleteSync(fence);
+
+	return (uint32_t*)_buffers.GetMapped(slot);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
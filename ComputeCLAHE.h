@@ -6,19 +6,22 @@
 #pragma once
 
 #include "core.h"
+#include "BufferPool.h"
 
 class ComputeCLAHE {
 private:
 
 	// CLAHE and Focused CLAHE Compute Shaders
 	GLuint _minMaxShader, _LUTshader; 
-	GLuint _histShader;
-	GLuint _excessShader, _clipShaderPass1, _clipShaderPass2;
+	GLuint _histShader, _histMaxShader;
+	GLuint _clipShader;
+	GLuint _cdfShader;
 	GLuint _lerpShader, _lerpShader_Focused;
 	// Masked CLAHE Compute Shaders
 	GLuint _minMaxShader_Masked, _LUTShader_Masked;
 	GLuint _histShader_Masked;
-	GLuint _excessShader_Masked, _clipShaderPass1_Masked, _clipShaderPass2_Masked;
+	GLuint _clipShader_Masked;
+	GLuint _cdfShader_Masked;
 	GLuint _lerpShader_Masked;
 
 	// DICON Volume Data 
@@ -30,6 +33,15 @@ private:
 	GLuint _LUTbuffer, _histBuffer, _histMaxBuffer;
 	GLuint _layer = 1;
 
+	// Buffers are kept between calls and re-used
+	enum BufferSlot {
+		LUT_BUFFER, HIST_BUFFER, HIST_MAX_BUFFER,
+		MIN_MAX_BUFFER, MIN_BUFFER, MAX_BUFFER, PIXEL_COUNT_BUFFER,
+		// persistent mapped buffers the host reads results from
+		MIN_MAX_READBACK
+	};
+	BufferPool _buffers;
+
 	// Focused CLAHE Parameters
 	glm::ivec3 _pixelRatio = glm::ivec3(100, 100, 50);
 	glm::ivec3 _minPixels = glm::ivec3(25, 25, 20);
@@ -38,18 +50,27 @@ private:
 	int _numOrgans = 4;
 
 	// CLAHE Compute Shader Functions
-	void computeLUT(glm::uvec3 volDims, uint32_t* minMax, bool useLUT,  glm::uvec3 offset = glm::uvec3(0));
-	void computeLUT_Masked(glm::uvec3 volDims, uint32_t* min, uint32_t* max, uint32_t* pixelCount);
+	// returns a fence for the min/max readback
+	GLsync computeLUT(glm::uvec3 volDims, uint32_t* minMax, bool useLUT,  glm::uvec3 offset = glm::uvec3(0));
+	void computeLUT_Masked(glm::uvec3 volDims);
 
 	void computeHist(glm::uvec3 volDims, glm::uvec3 numSB, bool useLUT, glm::uvec3 offset = glm::uvec3(0));
 	void computeHist_Masked(glm::uvec3 volDims, bool useLUT);
+	void computeHistMax(uint32_t numHistograms);
+
+	void computeClipHist(glm::uvec3 volDims, glm::uvec3 numSB, float clipLimit, GLsync minMaxFence);
+	void computeClipHist_Masked(float clipLimit);
 
-	void computeClipHist(glm::uvec3 volDims, glm::uvec3 numSB, float clipLimit, uint32_t* minMax, int numPixels = -1);
-	void computeClipHist_Masked(glm::uvec3 volDims, float clipLimit, uint32_t* min, uint32_t* max, uint32_t* numPixels);
+	GLuint computeLerp(glm::uvec3 volDims, glm::uvec3 numSB, bool useLUT, GLuint newVolumeTexture, 
+						glm::uvec3 offset = glm::uvec3(0));
+	GLuint computeLerp_Focused(glm::uvec3 volDims, glm::uvec3 numSB, glm::uvec3 minVal, glm::vec3 maxVal, bool useLUT, 
+						GLuint newVolumeTexture);
+	GLuint computeLerp_Masked(glm::uvec3 volDims, bool useLUT, GLuint newVolumeTexture);
 
-	GLuint computeLerp(glm::uvec3 volDims, glm::uvec3 numSB, bool useLUT, glm::uvec3 offset = glm::uvec3(0));
-	GLuint computeLerp_Focused(glm::uvec3 volDims, glm::uvec3 numSB, glm::uvec3 minVal, glm::vec3 maxVal, bool useLUT);
-	GLuint computeLerp_Masked(glm::uvec3 volDims, bool useLUT);
+	// Helper Functions
+	GLuint createVolumeTexture();
+	GLsync queueReadback(GLuint srcBuffer, BufferSlot slot, GLsizeiptr size);
+	uint32_t* waitReadback(GLsync fence, BufferSlot slot);
 
 public:
 	ComputeCLAHE() {};
@@ -67,4 +88,14 @@ public:
 
 	// Change parameters for Focused CLAHE
 	bool ChangePixelsPerSB(bool decrease);
+
+	// Switch to another volume with the same dimensions (e.g. the next phase of a time series)
+	void SetVolumeTexture(GLuint volumeTexture)	{ _volumeTexture = volumeTexture; }
+
+	// Number of histogram bins for data with the given BitsStored and value range,
+	// pass the result as finalGrayVals
+	static unsigned int GetNumBins(unsigned int bitsStored, double minVal, double maxVal, unsigned int maxBins = 4096);
+
+	// Largest amount of buffer memory used so far (bytes)
+	GLsizeiptr GetBufferHighWaterMark()	{ return _buffers.GetHighWaterMark(); }
 };
\ No newline at end of file
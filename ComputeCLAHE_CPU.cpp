@@ -0,0 +1,584 @@
+////////////////////////////////////////
+// ComputeCLAHE_CPU.cpp
+////////////////////////////////////////
+
+#include "ComputeCLAHE_CPU.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdio.h>
+
+// The AVX2 lerp kernel is compiled for x64 and only used when the CPU supports it
+#if defined(_MSC_VER) && defined(_M_X64)
+#define CLAHE_HAVE_AVX2
+#define CLAHE_TARGET_AVX2
+#include <intrin.h>
+#include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define CLAHE_HAVE_AVX2
+#define CLAHE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Neighbooring sub-blocks and normalized interpolation weights for one
+// coordinate along one axis of the volume
+struct LerpAxis {
+	uint32_t lo, hi;		// left/right, up/down or front/back sub-block
+	float wLo, wHi;			// weights for the lo/hi sub-blocks, wLo + wHi == 1
+};
+
+// Interpolation weights of every column, shared by all of the rows
+struct LerpColumns {
+	vector<uint32_t> loOffset, hiOffset;	// offset of the lo/hi histogram in a row of histograms
+	vector<float> wLo, wHi;
+};
+
+// One row of voxels to interpolate
+struct LerpRow {
+	const uint16_t* volume;					// input gray values
+	float* newVolume;						// output values
+	const uint32_t* LUT;					// nullptr when not using the LUT
+	const uint32_t *UF, *DF, *UB, *DB;		// rows of histograms of the neighbooring sub-blocks
+	float yLo, yHi, zLo, zHi;				// weights of the row
+	float invNumBins;
+};
+
+static void buildLerpAxis(vector<LerpAxis>& axis, int dim, int numSB);
+static void lerpRow_Scalar(const LerpRow& row, const LerpColumns& columns, int begin, int end);
+#ifdef CLAHE_HAVE_AVX2
+static int lerpRow_AVX2(const LerpRow& row, const LerpColumns& columns, int width);
+static bool cpuHasAVX2();
+#endif
+static void mapHistogram(uint32_t minVal, uint32_t maxVal, uint32_t numPixelsSB, uint32_t numBins, uint32_t* localHist);
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructors/Destructors
+
+ComputeCLAHE_CPU::ComputeCLAHE_CPU(const uint16_t* volume, glm::ivec3 volDims, unsigned int finalGrayVals,
+								unsigned int inGrayVals, unsigned int numThreads) {
+
+	Init(volume, volDims, finalGrayVals, inGrayVals, numThreads);
+}
+
+void ComputeCLAHE_CPU::Init(const uint16_t* volume, glm::ivec3 volDims, unsigned int finalGrayVals,
+							unsigned int inGrayVals, unsigned int numThreads) {
+
+	delete _pool;
+	_pool = new ThreadPool(numThreads);
+
+	// Volume Data
+	_volume = volume;
+	_numOutGrayVals = finalGrayVals;		_numInGrayVals = inGrayVals;
+	_volDims = volDims;
+
+#ifdef CLAHE_HAVE_AVX2
+	_useSIMD = cpuHasAVX2();
+#endif
+	printf("CPU CLAHE: %d threads, %s lerp\n", GetNumThreads(), _useSIMD ? "AVX2" : "scalar");
+}
+
+ComputeCLAHE_CPU::~ComputeCLAHE_CPU() {
+	delete _pool;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CLAHE Functions
+
+// 3D CLAHE
+// numSB     - number of sub-blocks to use for 3D CLAHE
+// clipLimit - [0,1] the smaller the value the lower the resulting contrast
+//             0 returns the original volume
+// Returns the new 3D CLAHE volume
+float* ComputeCLAHE_CPU::Compute3D_CLAHE(glm::uvec3 numSB, float clipLimit) {
+
+	printf("\n----- Compute 3D CLAHE (CPU, %d threads) ----- \n", GetNumThreads());
+	auto start = chrono::high_resolution_clock::now();
+
+	size_t numVoxels = (size_t)_volDims.x * _volDims.y * _volDims.z;
+
+	// make sure the clip limit is valid - ie. between [0, 1]
+	clipLimit = glm::clamp(clipLimit, 0.0f, 1.0f);
+	// clipLimit == 0 -> return the original volume
+	if (clipLimit == 0) {
+		float* newVolume = new float[numVoxels];
+		for (size_t i = 0; i < numVoxels; i++) {
+			newVolume[i] = _volume[i] / 65535.0f;
+		}
+		return newVolume;
+	}
+	// need at least one voxel per sub-block
+	numSB = glm::clamp(numSB, glm::uvec3(1), glm::uvec3(_volDims));
+	// if the number of gray values is changing --> use the LUT
+	bool useLUT = (_numOutGrayVals != _numInGrayVals);
+
+	// Create the LUT
+	uint32_t minMax[2] = { _numInGrayVals, 0 };
+	computeLUT(minMax, useLUT);
+
+	// Create the Histograms
+	computeHist(numSB, useLUT);
+	computeClipHist(numSB, clipLimit, minMax);
+
+	// Interpolate to create the new volume
+	float* newVolume = computeLerp(numSB, useLUT);
+
+	chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+	printf("CPU CLAHE took %.3fs\n", elapsed.count());
+	return newVolume;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CLAHE Stages
+
+void ComputeCLAHE_CPU::computeLUT(uint32_t* minMax, bool useLUT) {
+
+	////////////////////////////////////////////////////////////////////////////
+	// Calculate the Min/Max Values for the volume
+
+	unsigned int numChunks = GetNumThreads();
+	vector<uint32_t> chunkMin(numChunks, _numInGrayVals), chunkMax(numChunks, 0);
+
+	_pool->ParallelFor(_volDims.z, [&](unsigned int zBegin, unsigned int zEnd, unsigned int chunk) {
+		const uint16_t* data = _volume + (size_t)zBegin * _volDims.x * _volDims.y;
+		const uint16_t* dataEnd = _volume + (size_t)zEnd * _volDims.x * _volDims.y;
+		uint32_t localMin = _numInGrayVals, localMax = 0;
+		for (; data < dataEnd; data++) {
+			localMin = std::min(localMin, (uint32_t)*data);
+			localMax = std::max(localMax, (uint32_t)*data);
+		}
+		chunkMin[chunk] = localMin;
+		chunkMax[chunk] = localMax;
+	}, numChunks);
+
+	for (unsigned int i = 0; i < numChunks; i++) {
+		minMax[0] = std::min(minMax[0], chunkMin[i]);
+		minMax[1] = std::max(minMax[1], chunkMax[i]);
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// Compute the LUT - same mapping as LUT.comp
+
+	_LUT.assign(_numInGrayVals, 0);
+	if (useLUT) {
+		// values outside of [min, max] are clamped to the end bins
+		uint32_t binSize = 1 + (minMax[1] - minMax[0]) / _numOutGrayVals;
+		for (uint32_t i = 0; i < _numInGrayVals; i++) {
+			_LUT[i] = (std::min(std::max(i, minMax[0]), minMax[1]) - minMax[0]) / binSize;
+		}
+	}
+}
+
+void ComputeCLAHE_CPU::computeHist(glm::uvec3 numSB, bool useLUT) {
+
+	uint32_t numHistograms = numSB.x * numSB.y * numSB.z;
+	uint32_t layerHistograms = numSB.x * numSB.y;
+	size_t layerSize = (size_t)layerHistograms * _numOutGrayVals;
+	glm::uvec3 sizeSB = glm::uvec3(_volDims) / numSB;
+
+	// sub-block each x/y/z coordinate belongs to, voxels past the last
+	// full sub-block are counted in the last sub-block
+	vector<size_t> sbOffsetX(_volDims.x);
+	vector<uint32_t> sbY(_volDims.y), sbZ(_volDims.z);
+	for (int x = 0; x < _volDims.x; x++) {
+		sbOffsetX[x] = (size_t)std::min(x / sizeSB.x, numSB.x - 1) * _numOutGrayVals;
+	}
+	for (int y = 0; y < _volDims.y; y++) {
+		sbY[y] = std::min(y / sizeSB.y, numSB.y - 1);
+	}
+	for (int z = 0; z < _volDims.z; z++) {
+		sbZ[z] = std::min(z / sizeSB.z, numSB.z - 1);
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// Each chunk of slices fills its own private histograms for the layers of
+	// sub-blocks it touches -> no atomics or locks while counting
+
+	unsigned int numChunks = GetNumThreads();
+	vector<vector<uint32_t>> localHists(numChunks);
+	vector<uint32_t> firstLayer(numChunks, 0), lastLayer(numChunks, 0);
+
+	_pool->ParallelFor(_volDims.z, [&](unsigned int zBegin, unsigned int zEnd, unsigned int chunk) {
+		uint32_t first = sbZ[zBegin];
+		uint32_t last = sbZ[zEnd - 1];
+		firstLayer[chunk] = first;
+		lastLayer[chunk] = last;
+
+		vector<uint32_t>& localHist = localHists[chunk];
+		localHist.assign((last - first + 1) * layerSize, 0);
+
+		for (unsigned int z = zBegin; z < zEnd; z++) {
+			uint32_t* layerHist = &localHist[(sbZ[z] - first) * layerSize];
+			for (int y = 0; y < _volDims.y; y++) {
+				uint32_t* rowHist = layerHist + (size_t)sbY[y] * numSB.x * _numOutGrayVals;
+				const uint16_t* row = _volume + ((size_t)z * _volDims.y + y) * _volDims.x;
+				if (useLUT) {
+					for (int x = 0; x < _volDims.x; x++) {
+						rowHist[sbOffsetX[x] + _LUT[row[x]]]++;
+					}
+				}
+				else {
+					for (int x = 0; x < _volDims.x; x++) {
+						rowHist[sbOffsetX[x] + row[x]]++;
+					}
+				}
+			}
+		}
+	}, numChunks);
+
+	////////////////////////////////////////////////////////////////////////////
+	// Merge the private histograms and find the max value of each histogram
+
+	_hist.resize((size_t)numHistograms * _numOutGrayVals);
+	_histMax.assign(numHistograms, 0);
+
+	_pool->ParallelFor(numHistograms, [&](unsigned int histBegin, unsigned int histEnd, unsigned int) {
+		for (unsigned int currHistIndex = histBegin; currHistIndex < histEnd; currHistIndex++) {
+			uint32_t layer = currHistIndex / layerHistograms;
+			uint32_t* currHist = &_hist[(size_t)currHistIndex * _numOutGrayVals];
+			memset(currHist, 0, _numOutGrayVals * sizeof(uint32_t));
+
+			for (unsigned int chunk = 0; chunk < numChunks; chunk++) {
+				if (localHists[chunk].empty() || layer < firstLayer[chunk] || layer > lastLayer[chunk]) {
+					continue;
+				}
+				size_t localIndex = currHistIndex - firstLayer[chunk] * layerHistograms;
+				const uint32_t* localHist = &localHists[chunk][localIndex * _numOutGrayVals];
+				for (unsigned int i = 0; i < _numOutGrayVals; i++) {
+					currHist[i] += localHist[i];
+				}
+			}
+			_histMax[currHistIndex] = *std::max_element(currHist, currHist + _numOutGrayVals);
+		}
+	});
+}
+
+void ComputeCLAHE_CPU::computeClipHist(glm::uvec3 numSB, float clipLimit, uint32_t* minMax) {
+
+	uint32_t numHistograms = numSB.x * numSB.y * numSB.z;
+	glm::uvec3 sizeSB = glm::uvec3(_volDims) / numSB;
+	// the last sub-block on each axis also counts the remainder of the volume
+	glm::uvec3 lastSizeSB = glm::uvec3(_volDims) - (numSB - 1u) * sizeSB;
+
+	// each histogram is clipped and mapped independently
+	_pool->ParallelFor(numHistograms, [&](unsigned int histBegin, unsigned int histEnd, unsigned int) {
+		for (unsigned int currHistIndex = histBegin; currHistIndex < histEnd; currHistIndex++) {
+			uint32_t* currHist = &_hist[(size_t)currHistIndex * _numOutGrayVals];
+
+			// number of voxels counted into this histogram
+			glm::uvec3 currSB(currHistIndex % numSB.x, (currHistIndex / numSB.x) % numSB.y, currHistIndex / (numSB.x * numSB.y));
+			glm::uvec3 currSizeSB = sizeSB;
+			if (currSB.x == numSB.x - 1) currSizeSB.x = lastSizeSB.x;
+			if (currSB.y == numSB.y - 1) currSizeSB.y = lastSizeSB.y;
+			if (currSB.z == numSB.z - 1) currSizeSB.z = lastSizeSB.z;
+			uint32_t numPixelsSB = currSizeSB.x * currSizeSB.y * currSizeSB.z;
+
+			// calculate the minClipValue
+			float tempClipValue = 1.1f * numPixelsSB / _numOutGrayVals;
+			uint32_t minClipValue = (uint32_t)(tempClipValue + 0.5f);
+
+			if (clipLimit < 1.0f) {
+				uint32_t clipValue = (uint32_t)(float(_histMax[currHistIndex]) * clipLimit);
+				clipValue = std::max(minClipValue, clipValue);
+
+				////////////////////////////////////////////////////////////////
+				// Calculate the excess pixels based on the clipLimit - clipHist.comp
+				uint32_t excess = 0;
+				for (unsigned int i = 0; i < _numOutGrayVals; i++) {
+					excess += currHist[i] > clipValue ? currHist[i] - clipValue : 0;
+				}
+
+				////////////////////////////////////////////////////////////////
+				// Clip the Histogram - Pass 1 - clipHist.comp
+				// - clip the values and re-distribute to all pixels
+				uint32_t avgInc = excess / _numOutGrayVals;
+				uint32_t upperLimit = clipValue - avgInc;	// Bins larger than upperLimit set to clipValue
+				for (unsigned int i = 0; i < _numOutGrayVals; i++) {
+					uint32_t histValue = currHist[i];
+					if (histValue > clipValue) {
+						currHist[i] = clipValue;
+					}
+					else if (histValue > upperLimit) {
+						if (avgInc > 0) {
+							excess -= std::min(excess, histValue - upperLimit);
+						}
+						currHist[i] = clipValue;
+					}
+					else if (avgInc > 0) {
+						excess -= std::min(excess, avgInc);
+						currHist[i] += avgInc;
+					}
+				}
+
+				////////////////////////////////////////////////////////////////
+				// Clip the Histogram - Pass 2 - clipHist.comp
+				// - redistribute the remaining excess pixels, one to every stepSize'th
+				//   bin below the clipValue, shifting the start each sweep
+				for (uint32_t sweep = 0; excess > 0; sweep++) {
+					uint32_t stepSize = std::max(_numOutGrayVals / excess, 1u);
+					uint32_t phase = sweep % stepSize;
+
+					// the GPU counts the candidates of a sweep before handing out pixels
+					uint32_t underClip = 0, handedOut = 0;
+					for (unsigned int i = 0; i < _numOutGrayVals; i++) {
+						if (currHist[i] < clipValue) {
+							underClip++;
+							if (i % stepSize == phase && handedOut < excess) {
+								currHist[i]++;
+								handedOut++;
+							}
+						}
+					}
+					// every bin is full -> nothing left to do
+					if (underClip == 0) {
+						break;
+					}
+					excess -= handedOut;
+				}
+			}
+
+			////////////////////////////////////////////////////////////////////
+			// Map the histogram
+			// - calculate the CDF for the histogram and store it in hist
+			mapHistogram(minMax[0], minMax[1], numPixelsSB, _numOutGrayVals, currHist);
+		}
+	});
+}
+
+float* ComputeCLAHE_CPU::computeLerp(glm::uvec3 numSB, bool useLUT) {
+
+	size_t numVoxels = (size_t)_volDims.x * _volDims.y * _volDims.z;
+	float* newVolume = new float[numVoxels];
+
+	// neighbooring sub-blocks and weights of every row/column/slice
+	vector<LerpAxis> xAxis, yAxis, zAxis;
+	buildLerpAxis(xAxis, _volDims.x, numSB.x);
+	buildLerpAxis(yAxis, _volDims.y, numSB.y);
+	buildLerpAxis(zAxis, _volDims.z, numSB.z);
+
+	// the x weights are shared by every row, store them so the kernels
+	// can load 8 columns at a time
+	LerpColumns columns;
+	for (int x = 0; x < _volDims.x; x++) {
+		columns.loOffset.push_back(xAxis[x].lo * _numOutGrayVals);
+		columns.hiOffset.push_back(xAxis[x].hi * _numOutGrayVals);
+		columns.wLo.push_back(xAxis[x].wLo);
+		columns.wHi.push_back(xAxis[x].wHi);
+	}
+
+	size_t rowStride = (size_t)numSB.x * _numOutGrayVals;
+	size_t layerStride = (size_t)numSB.y * rowStride;
+	bool useSIMD = _useSIMD;
+
+	// use more chunks than threads so the workers stay balanced
+	_pool->ParallelFor(_volDims.z, [&](unsigned int zBegin, unsigned int zEnd, unsigned int) {
+		LerpRow row;
+		row.LUT = useLUT ? _LUT.data() : nullptr;
+		row.invNumBins = 1.0f / float(_numInGrayVals);
+
+		for (unsigned int z = zBegin; z < zEnd; z++) {
+			const LerpAxis& zw = zAxis[z];
+			row.zLo = zw.wLo;		row.zHi = zw.wHi;
+
+			for (int y = 0; y < _volDims.y; y++) {
+				const LerpAxis& yw = yAxis[y];
+				row.yLo = yw.wLo;	row.yHi = yw.wHi;
+
+				// rows of histograms for the neighbooring subblocks
+				row.UF = &_hist[zw.lo * layerStride + yw.lo * rowStride];
+				row.DF = &_hist[zw.lo * layerStride + yw.hi * rowStride];
+				row.UB = &_hist[zw.hi * layerStride + yw.lo * rowStride];
+				row.DB = &_hist[zw.hi * layerStride + yw.hi * rowStride];
+
+				size_t rowIndex = ((size_t)z * _volDims.y + y) * _volDims.x;
+				row.volume = _volume + rowIndex;
+				row.newVolume = newVolume + rowIndex;
+
+				int x = 0;
+#ifdef CLAHE_HAVE_AVX2
+				if (useSIMD) {
+					x = lerpRow_AVX2(row, columns, _volDims.x);
+				}
+#endif
+				lerpRow_Scalar(row, columns, x, _volDims.x);
+
+#ifdef CLAHE_VALIDATE_LERP
+				// check the SIMD kernel against the scalar version of lerp.comp
+				if (useSIMD) {
+					vector<float> simdRow(row.newVolume, row.newVolume + _volDims.x);
+					lerpRow_Scalar(row, columns, 0, _volDims.x);
+					for (int i = 0; i < _volDims.x; i++) {
+						if (std::fabs(simdRow[i] - row.newVolume[i]) > 1e-5f) {
+							printf("Lerp mismatch at (%d, %d, %d): %f vs %f\n", i, y, z, simdRow[i], row.newVolume[i]);
+						}
+					}
+				}
+#endif
+			}
+		}
+	}, 4 * GetNumThreads());
+
+	return newVolume;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Lerp Kernels
+
+// Scalar version - same math as lerp.comp
+// Interpolates the columns [begin, end) of the row
+static void lerpRow_Scalar(const LerpRow& row, const LerpColumns& columns, int begin, int end) {
+
+	for (int x = begin; x < end; x++) {
+
+		// get the current gray value
+		uint32_t grayValue = row.LUT ? row.LUT[row.volume[x]] : row.volume[x];
+		uint32_t L = columns.loOffset[x] + grayValue;
+		uint32_t R = columns.hiOffset[x] + grayValue;
+		float wLo = columns.wLo[x], wHi = columns.wHi[x];
+
+		// bilinear interpolation - zFront
+		float up_front = wLo * row.UF[L] + wHi * row.UF[R];
+		float dn_front = wLo * row.DF[L] + wHi * row.DF[R];
+		float front = row.yLo * up_front + row.yHi * dn_front;
+
+		// bilinear interpolation - zBack
+		float up_back = wLo * row.UB[L] + wHi * row.UB[R];
+		float dn_back = wLo * row.DB[L] + wHi * row.DB[R];
+		float back = row.yLo * up_back + row.yHi * dn_back;
+
+		// trilinear interpolation
+		row.newVolume[x] = (row.zLo * front + row.zHi * back) * row.invNumBins;
+	}
+}
+
+#ifdef CLAHE_HAVE_AVX2
+// AVX2 version - 8 voxels per iteration, the 8 CDF values of each voxel are
+// gathered from the histograms and blended with FMAs
+// Returns the number of columns done, the rest is left for the scalar kernel
+CLAHE_TARGET_AVX2
+static int lerpRow_AVX2(const LerpRow& row, const LerpColumns& columns, int width) {
+
+	const int* UF = (const int*)row.UF;		const int* DF = (const int*)row.DF;
+	const int* UB = (const int*)row.UB;		const int* DB = (const int*)row.DB;
+	const int* LUT = (const int*)row.LUT;
+
+	// row weights are the same for every voxel of the row
+	const __m256 yLo = _mm256_set1_ps(row.yLo), yHi = _mm256_set1_ps(row.yHi);
+	const __m256 zLo = _mm256_set1_ps(row.zLo * row.invNumBins);
+	const __m256 zHi = _mm256_set1_ps(row.zHi * row.invNumBins);
+
+	int x = 0;
+	for (; x + 8 <= width; x += 8) {
+
+		// get the current gray values
+		__m256i grayValue = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(row.volume + x)));
+		if (LUT) {
+			grayValue = _mm256_i32gather_epi32(LUT, grayValue, 4);
+		}
+		__m256i L = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&columns.loOffset[x]), grayValue);
+		__m256i R = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&columns.hiOffset[x]), grayValue);
+		__m256 wLo = _mm256_loadu_ps(&columns.wLo[x]);
+		__m256 wHi = _mm256_loadu_ps(&columns.wHi[x]);
+
+		// bilinear interpolation - zFront
+		__m256 up_front = _mm256_fmadd_ps(wHi, _mm256_cvtepi32_ps(_mm256_i32gather_epi32(UF, R, 4)),
+							_mm256_mul_ps(wLo, _mm256_cvtepi32_ps(_mm256_i32gather_epi32(UF, L, 4))));
+		__m256 dn_front = _mm256_fmadd_ps(wHi, _mm256_cvtepi32_ps(_mm256_i32gather_epi32(DF, R, 4)),
+							_mm256_mul_ps(wLo, _mm256_cvtepi32_ps(_mm256_i32gather_epi32(DF, L, 4))));
+		__m256 front = _mm256_fmadd_ps(yHi, dn_front, _mm256_mul_ps(yLo, up_front));
+
+		// bilinear interpolation - zBack
+		__m256 up_back = _mm256_fmadd_ps(wHi, _mm256_cvtepi32_ps(_mm256_i32gather_epi32(UB, R, 4)),
+							_mm256_mul_ps(wLo, _mm256_cvtepi32_ps(_mm256_i32gather_epi32(UB, L, 4))));
+		__m256 dn_back = _mm256_fmadd_ps(wHi, _mm256_cvtepi32_ps(_mm256_i32gather_epi32(DB, R, 4)),
+							_mm256_mul_ps(wLo, _mm256_cvtepi32_ps(_mm256_i32gather_epi32(DB, L, 4))));
+		__m256 back = _mm256_fmadd_ps(yHi, dn_back, _mm256_mul_ps(yLo, up_back));
+
+		// trilinear interpolation
+		_mm256_storeu_ps(row.newVolume + x, _mm256_fmadd_ps(zHi, back, _mm256_mul_ps(zLo, front)));
+	}
+	return x;
+}
+
+// AVX2 and FMA are supported by the CPU and enabled by the OS
+static bool cpuHasAVX2() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	if (!osxsave || !fma || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Helper Methods
+
+// Same neighboors and coefficients as lerp.comp, the volume is split into
+// 2x numSB blocks and each block interpolates between the closest sub-blocks
+static void buildLerpAxis(vector<LerpAxis>& axis, int dim, int numSB) {
+
+	int numBlocks = numSB * 2;
+	int sizeBlock = std::max(dim / numBlocks, 1);
+
+	axis.resize(dim);
+	for (int i = 0; i < dim; i++) {
+		// voxels past the last full block belong to the last block
+		int currBlock = std::min(i / sizeBlock, numBlocks - 1);
+		int size = sizeBlock;
+		int a = i - currBlock * sizeBlock;
+		uint32_t lo, hi;
+
+		if (currBlock == 0) {
+			lo = 0;							hi = 0;
+		}
+		else if (currBlock == numBlocks - 1) {
+			lo = currBlock / 2;				hi = lo;
+		}
+		else {
+			size *= 2;
+			if (currBlock % 2 == 0) {
+				lo = currBlock / 2 - 1;		hi = lo + 1;
+				a += sizeBlock;
+			}
+			else {
+				lo = currBlock / 2;			hi = lo + 1;
+			}
+		}
+
+		axis[i].lo = lo;
+		axis[i].hi = hi;
+		axis[i].wHi = float(a) / float(size);
+		axis[i].wLo = float(size - a) / float(size);
+	}
+}
+
+// calculate the normalized CDF of the histogram
+static void mapHistogram(uint32_t minVal, uint32_t maxVal, uint32_t numPixelsSB, uint32_t numBins, uint32_t* localHist) {
+
+	float sum = 0;
+	const float scale = ((float)(maxVal - minVal)) / (float)numPixelsSB;
+
+	// for each bin
+	for (unsigned int i = 0; i < numBins; i++) {
+
+		// add the histogram value for this contextual region to the sum
+		sum += localHist[i];
+
+		// normalize the cdf
+		localHist[i] = (unsigned int)(std::min(minVal + sum * scale, (float)maxVal));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
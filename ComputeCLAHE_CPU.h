@@ -0,0 +1,58 @@
+////////////////////////////////////////
+// ComputeCLAHE_CPU.h
+// Compute 3D CLAHE on the host using a thread pool, for machines without a GPU
+////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+
+class ComputeCLAHE_CPU {
+private:
+
+	// Worker Threads
+	ThreadPool* _pool = nullptr;
+	bool _useSIMD = false;	// use the AVX2 lerp kernel
+
+	// DICOM Volume Data
+	const uint16_t* _volume = nullptr;
+	unsigned int _numOutGrayVals, _numInGrayVals;
+	glm::ivec3 _volDims;
+
+	// CLAHE Buffers and Data
+	std::vector<uint32_t> _LUT, _hist, _histMax;
+
+	// CLAHE Stages - same steps as the Compute Shaders
+	void computeLUT(uint32_t* minMax, bool useLUT);
+	void computeHist(glm::uvec3 numSB, bool useLUT);
+	void computeClipHist(glm::uvec3 numSB, float clipLimit, uint32_t* minMax);
+	float* computeLerp(glm::uvec3 numSB, bool useLUT);
+
+public:
+	ComputeCLAHE_CPU() {};
+	ComputeCLAHE_CPU(const uint16_t* volume, glm::ivec3 volDims, unsigned int finalGrayVals,
+					unsigned int inGrayVals, unsigned int numThreads = 0);
+	~ComputeCLAHE_CPU();
+
+	// volume     - host copy of the DICOM volume (ie. ImageLoader::GetImageData())
+	// numThreads - 0 uses one thread per hardware thread
+	void Init(const uint16_t* volume, glm::ivec3 volDims, unsigned int finalGrayVals,
+				unsigned int inGrayVals, unsigned int numThreads = 0);
+
+	// CLAHE Methods
+	// Returns a new volDims.x * volDims.y * volDims.z buffer with the same normalized
+	// values the GPU writes into its R16F texture, the caller deletes it with delete[]
+	float* Compute3D_CLAHE(glm::uvec3 numSB, float clipLimit);
+
+	// Force the scalar lerp kernel, ie. to compare against the AVX2 kernel
+	void DisableSIMD()				{ _useSIMD = false; }
+
+	// Getters
+	unsigned int GetNumThreads()	{ return _pool ? _pool->GetNumThreads() : 0; }
+	bool UsingSIMD()				{ return _useSIMD; }
+};
@@ -56,7 +56,8 @@ Cube::~Cube() {
 ////////////////////////////////////////////////////////////////////////////////
 
 void Cube::Draw(GLuint shader, const glm::mat4& VPMatrix, const glm::vec3& CamPos, 
-				GLuint texture, GLuint maskTexture, bool useMask) {
+				GLuint texture, GLuint occupancyTexture, bool useMask, 
+				GLuint macrocellTexture, GLuint maskCellTexture) {
 
 	glUseProgram(shader);
 
@@ -65,12 +66,21 @@ void Cube::Draw(GLuint shader, const glm::mat4& VPMatrix, const glm::vec3& CamPo
 	//glBindImageTexture(0, texture, 0, GL_TRUE, 1, GL_READ_ONLY, GL_R16UI);	
 	glUniform1i(glGetUniformLocation(shader, "Volume"), 0);
 
-	//glActiveTexture(GL_TEXTURE1);
-	//glBindTexture(GL_TEXTURE_3D, maskTexture);
-	//glUniform1i(glGetUniformLocation(shader, "Mask"), 1);
-	glBindImageTexture(1, maskTexture, 0, GL_TRUE, 1, GL_READ_ONLY, GL_R8UI);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_3D, occupancyTexture);
+	glUniform1i(glGetUniformLocation(shader, "Occupancy"), 1);
 	glUniform1i(glGetUniformLocation(shader, "useMask"), useMask);
 
+	// empty space skipping
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_3D, macrocellTexture);
+	glUniform1i(glGetUniformLocation(shader, "Macrocells"), 2);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_3D, maskCellTexture);
+	glUniform1i(glGetUniformLocation(shader, "MaskCells"), 3);
+	glUniform1i(glGetUniformLocation(shader, "useMacrocells"), macrocellTexture != 0);
+	glActiveTexture(GL_TEXTURE0);
+
 	glUniformMatrix4fv(glGetUniformLocation(shader, "MVP"), 1, GL_FALSE, (float*)&VPMatrix);
 	glUniform3f(glGetUniformLocation(shader, "CameraPosition"), CamPos.x, CamPos.y, CamPos.z);
 	//glUniform3f(glGetUniformLocation(shader, "CameraPosition"), 0, 0, 0);
@@ -16,6 +16,7 @@ public:
 	~Cube();
 
 	void Draw(GLuint shader, const glm::mat4& VPMatrix, const glm::vec3& CamPos, 
-			  GLuint texture, GLuint maskTexture, bool useMask=false);
+			  GLuint texture, GLuint occupancyTexture, bool useMask=false, 
+			  GLuint macrocellTexture=0, GLuint maskCellTexture=0);
 	//void update();
 };
\ No newline at end of file
@@ -0,0 +1,136 @@
+////////////////////////////////////////
+// DynamicResolution.cpp
+////////////////////////////////////////
+
+#include "DynamicResolution.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cmath>
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructor/Destructor
+
+void DynamicResolution::Init(int width, int height) {
+
+	_upsampleShader = LoadShaders("display.vert", "upsample.frag");
+	// display.vert makes the full screen triangle from gl_VertexID
+	glGenVertexArrays(1, &_VAO);
+	glGenQueries(2, _timerQueries);
+
+	Resize(width, height);
+}
+
+DynamicResolution::~DynamicResolution() {
+	glDeleteProgram(_upsampleShader);
+	glDeleteVertexArrays(1, &_VAO);
+	glDeleteQueries(2, _timerQueries);
+	glDeleteFramebuffers(1, &_FBO);
+	glDeleteTextures(1, &_colorTexture);
+}
+
+void DynamicResolution::Resize(int width, int height) {
+
+	_width = std::max(width, 1);
+	_height = std::max(height, 1);
+	_renderWidth = _width;
+	_renderHeight = _height;
+
+	if (_colorTexture != 0) {
+		glDeleteTextures(1, &_colorTexture);
+	}
+	glGenTextures(1, &_colorTexture);
+	glBindTexture(GL_TEXTURE_2D, _colorTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, _width, _height);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (_FBO == 0) {
+		glGenFramebuffers(1, &_FBO);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, _FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _colorTexture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Rendering
+
+void DynamicResolution::Begin(bool moving) {
+
+	updateScale();
+
+	// refine to the full resolution as soon as the camera stops
+	float scale = moving ? _scale : 1.0f;
+	_renderWidth = std::max((int)(_width * scale), 1);
+	_renderHeight = std::max((int)(_height * scale), 1);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, _FBO);
+	glViewport(0, 0, _renderWidth, _renderHeight);
+
+	unsigned int query = _frame % 2;
+	_queryScale[query] = GetScale();
+	glBeginQuery(GL_TIME_ELAPSED, _timerQueries[query]);
+}
+
+void DynamicResolution::End() {
+
+	unsigned int query = _frame % 2;
+	glEndQuery(GL_TIME_ELAPSED);
+	_queryPending[query] = true;
+	_frame++;
+
+	Present();
+}
+
+void DynamicResolution::Present() {
+
+	// stretch the rendered part over the window
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, _width, _height);
+	glDisable(GL_BLEND);
+
+	glUseProgram(_upsampleShader);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, _colorTexture);
+	glUniform2f(glGetUniformLocation(_upsampleShader, "uvScale"), 
+		(float)_renderWidth / (float)_width, (float)_renderHeight / (float)_height);
+
+	glBindVertexArray(_VAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+}
+
+// raymarching cost grows with the number of pixels (scale^2), pick the scale that 
+// fits the measured frame into the target with some headroom
+void DynamicResolution::updateScale() {
+
+	// the query about to be re-used was issued two frames ago
+	unsigned int query = _frame % 2;
+	if (!_queryPending[query]) {
+		return;
+	}
+	GLint available = 0;
+	glGetQueryObjectiv(_timerQueries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+	_queryPending[query] = false;
+	if (!available) {
+		return;
+	}
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(_timerQueries[query], GL_QUERY_RESULT, &elapsed);
+	float frameTime = std::max((float)(elapsed * 1e-9), 1e-5f);
+
+	float budget = 0.8f * _targetFrameTime;
+	float newScale = _queryScale[query] * std::sqrt(budget / frameTime);
+	_scale = glm::clamp(0.5f * (_scale + newScale), _minScale, 1.0f);
+}
@@ -0,0 +1,50 @@
+////////////////////////////////////////
+// DynamicResolution.h
+// Renders the volume offscreen at a resolution that keeps interaction at the target 
+// frame time, and at full resolution once the camera stops
+////////////////////////////////////////
+
+#pragma once
+
+#include "core.h"
+
+class DynamicResolution {
+private:
+
+	// Offscreen Target - allocated at the window size, only part of it is used when scaled
+	GLuint _FBO = 0, _colorTexture = 0;
+	int _width = 0, _height = 0;
+	int _renderWidth = 0, _renderHeight = 0;
+
+	// Upsample to the window
+	GLuint _upsampleShader = 0, _VAO = 0;
+
+	// Frame time feedback
+	// - GPU time of the offscreen pass, read a frame late so the query never stalls
+	GLuint _timerQueries[2] = { 0, 0 };
+	bool _queryPending[2] = { false, false };
+	float _queryScale[2] = { 1.0f, 1.0f };	// resolution the query measured
+	unsigned int _frame = 0;
+	float _scale = 1.0f;				// resolution while moving, fraction of the window
+	float _minScale = 0.25f;
+	float _targetFrameTime = 1.0f / 60.0f;
+
+	void updateScale();
+
+public:
+	DynamicResolution() {};
+	~DynamicResolution();
+
+	void Init(int width, int height);
+	void Resize(int width, int height);
+
+	// Binds the offscreen target for the volume pass, at the scaled resolution while moving
+	void Begin(bool moving);
+	// Upsamples the volume pass to the window
+	void End();
+	// Upsamples the last volume pass again without rendering it
+	void Present();
+
+	// Getters
+	float GetScale()			{ return (float)_renderWidth / (float)_width; }
+};
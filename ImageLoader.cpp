@@ -2,25 +2,54 @@
 // ImageLoader.cpp
 ////////////////////////////////////////
 
-#define THREAD_COUNT 6
+#define PREFETCH_FILES 8	// files read ahead of the decoders
+#define SLAB_SLICES 16		// slices uploaded together while the rest still decode
 
 #ifdef WIN32
 #define NOMINMAX
-#include <Shlwapi.h>
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// The raw pixel conversion uses SSE2 on x64
+#if defined(_M_X64) || defined(__SSE2__)
+#define CLAHE_HAVE_SSE2
+#include <emmintrin.h>
 #endif
 
 #include <dcmtk/dcmimgle/dcmimage.h>
 #include <dcmtk/dcmdata/dctk.h>
+#include <dcmtk/dcmdata/dcrledrg.h>
+#include <dcmtk/dcmjpeg/djdecode.h>
+#include <dcmtk/dcmjpls/djdecode.h>
+#ifdef CLAHE_HAVE_FMJPEG2K
+#include <fmjpeg2k/djdecode.h>
+#endif
 
-#include <thread>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <limits>
+#include <map>
+#include <set>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb-master/stb_image.h>
 
 #include "ImageLoader.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
 
 using namespace std;
+namespace fs = std::filesystem;
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -46,42 +75,49 @@ string GetName(const string& path) {
 	return path.substr(f, l - f);
 }
 string GetFullPath(const string& str) {
-#ifdef WIN32
-	char buf[MAX_PATH];
-	if (GetFullPathName(str.c_str(), 256, buf, nullptr) == 0) {
-		printf("Failed to get full file path of %s (%d)", str.c_str(), GetLastError());
+	std::error_code err;
+	fs::path full = fs::absolute(str, err);
+	if (err) {
+		printf("Failed to get full file path of %s (%s)\n", str.c_str(), err.message().c_str());
 		return str;
 	}
-	return string(buf);
-#endif
+	return full.lexically_normal().string();
+}
+bool FileExists(const string& path) {
+	std::error_code err;
+	return fs::exists(path, err);
 }
+// dcm/raw/png files in the folder sorted by path (directory_iterator order is unspecified),
+// callers that need another order (ie. slice numbers) sort again
 void GetFiles(const string& path, vector<string>& files) {
-#ifdef WIN32
-	string d = path + "\\*";
+	std::error_code err;
+	for (const fs::directory_entry& entry : fs::directory_iterator(path, err)) {
+		string name = entry.path().filename().string();
+		if (name.empty() || name[0] == '.') continue;
 
-	WIN32_FIND_DATAA ffd;
-	HANDLE hFind = FindFirstFile(d.c_str(), &ffd);
-	if (hFind == INVALID_HANDLE_VALUE) {
-		assert(false);
-		return;
-	}
-
-	do {
-		if (ffd.cFileName[0] == L'.') continue;
-
-		string c = path + "\\" + ffd.cFileName;
-
-		if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+		std::error_code typeErr;
+		if (!entry.is_regular_file(typeErr)) {
 			// file is a directory
+			continue;
 		}
-		else {
-			string ext = GetExt(c);
-			if (ext == "dcm" || ext == "raw" || ext == "png")
-				files.push_back(GetFullPath(c));
-		}
-	} while (FindNextFileA(hFind, &ffd) != 0);
 
-	FindClose(hFind);
+		string ext = GetExt(name);
+		if (ext == "dcm" || ext == "raw" || ext == "png")
+			files.push_back(GetFullPath(entry.path().string()));
+	}
+	if (err) {
+		printf("Failed to list %s (%s)\n", path.c_str(), err.message().c_str());
+	}
+	std::sort(files.begin(), files.end());
+}
+
+// hint the OS to start reading the file in the background (cold NFS / disks)
+void PrefetchFile(const string& file) {
+#ifdef POSIX_FADV_WILLNEED
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
 #endif
 }
 
@@ -89,11 +125,12 @@ void GetFiles(const string& path, vector<string>& files) {
 // Texture Helpers 
 
 GLuint InitTexture2D(unsigned int width, unsigned int height, 
-		GLenum internalFormat, GLenum format, GLenum type, GLenum filter, void* data) {
+		GLenum internalFormat, GLenum format, GLenum type, GLenum filter, const void* data) {
 
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 	glBindTexture(GL_TEXTURE_2D, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, data);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -108,11 +145,12 @@ GLuint InitTexture2D(unsigned int width, unsigned int height,
 }
 
 GLuint InitTexture3D(unsigned int width, unsigned int height, unsigned int depth,
-	GLenum internalFormat, GLenum format, GLenum type, GLenum filter, void* data) {
+	GLenum internalFormat, GLenum format, GLenum type, GLenum filter, const void* data) {
 
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 	glBindTexture(GL_TEXTURE_3D, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, width, height, depth, 0, format, type, data);
 
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -127,53 +165,534 @@ GLuint InitTexture3D(unsigned int width, unsigned int height, unsigned int depth
 	return textureID;
 }
 
+// immutable storage only, filled in later with glTexSubImage3D
+GLuint InitTextureStorage3D(unsigned int width, unsigned int height, unsigned int depth,
+	GLenum internalFormat, GLenum filter) {
+
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_3D, textureID);
+	glTexStorage3D(GL_TEXTURE_3D, 1, internalFormat, width, height, depth);
+
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	return textureID;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Volume Cache
+// <folder>.clahe holds a CacheHeader followed by the raw voxels, it is written on the 
+// first load and memory mapped on later loads while the folder is unchanged
+
+#define CACHE_VERSION 2
+const char CACHE_MAGIC[8] = "CLAHEVC";
+
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t bytesPerVoxel;
+	uint32_t dims[3];
+	uint32_t bitsStored;
+	float size[3];				// volume size in meters
+	uint32_t numPhases;			// phases of a time series, stored one after another
+	double minVal, maxVal;
+	// source files, the cache is stale once these change
+	uint64_t numFiles;
+	int64_t newestWriteTime;
+};
+
+bool ImageLoader::_useCache = true;
+unsigned int ImageLoader::_numThreads = 0;
+
+string GetCachePath(const string& folder) {
+	fs::path path = fs::path(folder).lexically_normal();
+	if (!path.has_filename()) {
+		path = path.parent_path();
+	}
+	return path.string() + ".clahe";
+}
+
+int64_t GetNewestWriteTime(const vector<string>& files) {
+	// file_time_type may count from an epoch after 1970, so start from the lowest value
+	int64_t newest = std::numeric_limits<int64_t>::lowest();
+	for (const string& file : files) {
+		std::error_code err;
+		fs::file_time_type time = fs::last_write_time(file, err);
+		if (!err) {
+			newest = std::max(newest, (int64_t)time.time_since_epoch().count());
+		}
+	}
+	return newest;
+}
+
+// maps the cache, returns its header if it is valid for the source files
+const CacheHeader* OpenCache(const string& cachePath, const vector<string>& files, unsigned int bytesPerVoxel, 
+							MappedFile& cache) {
+
+	if (!cache.Open(cachePath)) {
+		return nullptr;
+	}
+
+	const CacheHeader* header = (const CacheHeader*)cache.GetData();
+	bool valid = cache.GetSize() >= sizeof(CacheHeader)
+		&& memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+		&& header->version == CACHE_VERSION
+		&& header->bytesPerVoxel == bytesPerVoxel
+		&& header->numPhases >= 1
+		&& cache.GetSize() == sizeof(CacheHeader) + (size_t)header->dims[0] * header->dims[1] * header->dims[2] 
+			* header->numPhases * bytesPerVoxel
+		&& header->numFiles == files.size()
+		&& header->newestWriteTime == GetNewestWriteTime(files);
+	if (!valid) {
+		printf("Cache %s is out of date\n", cachePath.c_str());
+		cache.Close();
+		return nullptr;
+	}
+	return header;
+}
+
+// header   - dims, size and range of the volume, the rest is filled in here
+// getSlice - copies slice z into dst (dims[0] * dims[1] * bytesPerVoxel bytes), the slices
+//            of phase p are z = p * dims[2] ... (p + 1) * dims[2] - 1
+void WriteCache(const string& cachePath, const vector<string>& files, CacheHeader header, 
+				const std::function<void(unsigned int, void*)>& getSlice) {
+
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.numFiles = files.size();
+	header.newestWriteTime = GetNewestWriteTime(files);
+
+	// write to a temporary file so a partial cache is never opened
+	string tempPath = cachePath + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file) {
+		printf("Could not write the cache %s\n", cachePath.c_str());
+		return;
+	}
+	size_t sliceSize = (size_t)header.dims[0] * header.dims[1] * header.bytesPerVoxel;
+	vector<unsigned char> slice(sliceSize);
+	bool ok = fwrite(&header, sizeof(CacheHeader), 1, file) == 1;
+	unsigned int numSlices = header.dims[2] * header.numPhases;
+	for (unsigned int z = 0; ok && z < numSlices; z++) {
+		getSlice(z, slice.data());
+		ok = fwrite(slice.data(), 1, sliceSize, file) == sliceSize;
+	}
+	ok = (fclose(file) == 0) && ok;
+
+	std::error_code err;
+	if (ok) {
+		fs::rename(tempPath, cachePath, err);
+	}
+	if (!ok || err) {
+		printf("Could not write the cache %s\n", cachePath.c_str());
+		fs::remove(tempPath, err);
+	}
+}
+
+void WriteCache(const string& cachePath, const vector<string>& files, CacheHeader header, const void* voxels) {
+	size_t sliceSize = (size_t)header.dims[0] * header.dims[1] * header.bytesPerVoxel;
+	WriteCache(cachePath, files, header, [&](unsigned int z, void* dst) {
+		memcpy(dst, (const unsigned char*)voxels + z * sliceSize, sliceSize);
+	});
+}
+
+CacheHeader MakeCacheHeader(glm::uvec3 dims, glm::vec3 size, unsigned int bytesPerVoxel) {
+	CacheHeader header = {};
+	header.bytesPerVoxel = bytesPerVoxel;
+	header.numPhases = 1;
+	header.dims[0] = dims.x;	header.dims[1] = dims.y;	header.dims[2] = dims.z;
+	header.size[0] = size.x;	header.size[1] = size.y;	header.size[2] = size.z;
+	return header;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Raw Pixel Helpers
+// Uncompressed little endian MONOCHROME2 slices skip DicomImage, the stored values
+// are mapped with the same min-max window DicomImage::setMinMaxWindow() applies
+
+// stored value of a raw 16 bit sample (masked to bitsStored, sign extended)
+inline int StoredValue(uint16_t raw, unsigned int bitsStored, bool isSigned) {
+	unsigned int shift = 16 - bitsStored;
+	if (isSigned) {
+		return (int16_t)(uint16_t)(raw << shift) >> shift;
+	}
+	return raw & (0xFFFFu >> shift);
+}
+
+// min/max of the stored values of count samples
+void RawMinMax(const uint16_t* raw, size_t count, unsigned int bitsStored, bool isSigned, int& minVal, int& maxVal) {
+
+	minVal = INT_MAX;
+	maxVal = INT_MIN;
+	size_t i = 0;
+
+#ifdef CLAHE_HAVE_SSE2
+	// 8 samples at a time, unsigned values are biased by 0x8000 for the signed compares
+	const __m128i shift = _mm_cvtsi32_si128(16 - bitsStored);
+	const __m128i mask = _mm_set1_epi16((short)(0xFFFFu >> (16 - bitsStored)));
+	const __m128i bias = _mm_set1_epi16(isSigned ? 0 : (short)0x8000);
+	__m128i vMin = _mm_set1_epi16(SHRT_MAX), vMax = _mm_set1_epi16(SHRT_MIN);
+	for (; i + 8 <= count; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(raw + i));
+		x = isSigned ? _mm_sra_epi16(_mm_sll_epi16(x, shift), shift) : _mm_xor_si128(_mm_and_si128(x, mask), bias);
+		vMin = _mm_min_epi16(vMin, x);
+		vMax = _mm_max_epi16(vMax, x);
+	}
+	int16_t mins[8], maxs[8];
+	_mm_storeu_si128((__m128i*)mins, _mm_xor_si128(vMin, bias));
+	_mm_storeu_si128((__m128i*)maxs, _mm_xor_si128(vMax, bias));
+	if (i > 0) {
+		for (int j = 0; j < 8; j++) {
+			minVal = std::min(minVal, isSigned ? (int)mins[j] : (int)(uint16_t)mins[j]);
+			maxVal = std::max(maxVal, isSigned ? (int)maxs[j] : (int)(uint16_t)maxs[j]);
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		int value = StoredValue(raw[i], bitsStored, isSigned);
+		minVal = std::min(minVal, value);
+		maxVal = std::max(maxVal, value);
+	}
+}
+
+// data[i] = clamp(stored value * scale + offset, 0, 65535), rounded
+void RawToWindowed(const uint16_t* raw, size_t count, unsigned int bitsStored, bool isSigned, 
+				float scale, float offset, uint16_t* data) {
+
+	size_t i = 0;
+	offset += 0.5f;
+
+#ifdef CLAHE_HAVE_SSE2
+	const __m128i shift = _mm_cvtsi32_si128(16 - bitsStored);
+	const __m128i mask = _mm_set1_epi16((short)(0xFFFFu >> (16 - bitsStored)));
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias32 = _mm_set1_epi32(32768), bias16 = _mm_set1_epi16((short)0x8000);
+	const __m128 vScale = _mm_set1_ps(scale), vOffset = _mm_set1_ps(offset);
+	const __m128 vLow = _mm_setzero_ps(), vHigh = _mm_set1_ps(65535.0f);
+	for (; i + 8 <= count; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(raw + i));
+
+		// widen to 32 bits
+		__m128i lo, hi;
+		if (isSigned) {
+			x = _mm_sra_epi16(_mm_sll_epi16(x, shift), shift);
+			lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+			hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		}
+		else {
+			x = _mm_and_si128(x, mask);
+			lo = _mm_unpacklo_epi16(x, zero);
+			hi = _mm_unpackhi_epi16(x, zero);
+		}
+
+		// scale, clamp and round
+		__m128 fLo = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), vScale), vOffset);
+		__m128 fHi = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), vScale), vOffset);
+		lo = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fLo, vLow), vHigh));
+		hi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fHi, vLow), vHigh));
+
+		// SSE2 only packs signed values, shift into the signed range and back
+		x = _mm_packs_epi32(_mm_sub_epi32(lo, bias32), _mm_sub_epi32(hi, bias32));
+		_mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(x, bias16));
+	}
+#endif
+
+	for (; i < count; i++) {
+		float value = StoredValue(raw[i], bitsStored, isSigned) * scale + offset;
+		data[i] = (uint16_t)std::min(std::max(value, 0.0f), 65535.0f);
+	}
+}
+
+// finds the PixelData value of an uncompressed little endian file, nullptr if it
+// is not there or does not hold length bytes
+const uint16_t* FindPixelData(const unsigned char* file, size_t size, uint32_t length) {
+
+	// (7FE0,0010) followed by OW/OB and a 32 bit length (explicit VR) or just the length (implicit VR)
+	const unsigned char tag[4] = { 0xE0, 0x7F, 0x10, 0x00 };
+	if (size < length + 12) {
+		return nullptr;
+	}
+
+	// the element is at the end of the data set, search backwards from the last possible start
+	for (size_t pos = size - length - 8; pos > 0; pos--) {
+		if (memcmp(file + pos, tag, 4) != 0) {
+			continue;
+		}
+		uint32_t valueLength;
+		if ((file[pos + 4] == 'O') && (file[pos + 5] == 'W' || file[pos + 5] == 'B') && pos + 12 + length <= size) {
+			memcpy(&valueLength, file + pos + 8, 4);
+			if (valueLength == length) {
+				return (const uint16_t*)(file + pos + 12);
+			}
+		}
+		memcpy(&valueLength, file + pos + 4, 4);
+		if (valueLength == length) {
+			return (const uint16_t*)(file + pos + 8);
+		}
+	}
+	return nullptr;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Dicom Readers
 
 struct Slice {
-	DicomImage* image;
-	double location;
+	string file;
+	double location = 0.0;
+	double spacingX = 0.0, spacingY = 0.0, thickness = 0.0;
+	unsigned int width = 0, height = 0, bitsStored = 16;
+	unsigned long frame = 0, numFrames = 1;		// frame of a multi-frame file
+	// time series keys (-1 if missing) and the phase they put the slice in
+	double temporalPosition = -1.0, triggerTime = -1.0, acquisitionNumber = -1.0;
+	unsigned int phase = 0;
+	// uncompressed little endian MONOCHROME2 -> PixelData is read directly
+	bool rawPixels = false, isSigned = false;
+	double slope = 1.0, intercept = 0.0;
+	// range of the stored values, filled in by the decode
+	double minVal = 0.0, maxVal = 0.0;
 };
 
-void ReadDicomSlice(DicomImage*& img, double& x, const string& file, double& spacingX, double& spacingY, double& thickness) {
-	OFCondition cnd;
+// Lock-free queue of decoded slice indices, written by the decode workers and
+// drained by the GL thread - every slice is pushed exactly once so it never wraps
+class SliceQueue {
+private:
+	std::unique_ptr<std::atomic<int>[]> _slots;
+	std::atomic<unsigned int> _writeIndex;
+	unsigned int _readIndex = 0, _capacity;
+
+public:
+	SliceQueue(unsigned int capacity) : _slots(new std::atomic<int>[capacity]), _writeIndex(0), _capacity(capacity) {
+		for (unsigned int i = 0; i < capacity; i++) {
+			_slots[i].store(-1, std::memory_order_relaxed);
+		}
+	}
+
+	void Push(int slice) {
+		_slots[_writeIndex.fetch_add(1)].store(slice, std::memory_order_release);
+	}
+	// returns -1 when no slice is ready
+	int Pop() {
+		if (_readIndex == _capacity) return -1;
+		int slice = _slots[_readIndex].load(std::memory_order_acquire);
+		if (slice >= 0) _readIndex++;
+		return slice;
+	}
+	bool Done()		{ return _readIndex == _capacity; }
+};
+
+// checks that a compressed transfer syntax has a registered decoder, each missing one is
+// reported once and its files are skipped
+bool HasDecoder(E_TransferSyntax xfer) {
+	DcmXfer xferInfo(xfer);
+	if (!xferInfo.isEncapsulated() || DcmCodecList::canChangeCoding(xfer, EXS_LittleEndianExplicit)) {
+		return true;
+	}
+
+	static std::mutex reportedMutex;
+	static std::set<E_TransferSyntax> reported;
+	std::lock_guard<std::mutex> lock(reportedMutex);
+	if (reported.insert(xfer).second) {
+		printf("No decoder registered for the transfer syntax %s (%s), its files are skipped\n",
+			xferInfo.getXferName(), xferInfo.getXferID());
+		if (xfer == EXS_JPEG2000LosslessOnly || xfer == EXS_JPEG2000) {
+			printf("JPEG 2000 needs fmjpeg2k, rebuild with -DCLAHE_USE_FMJPEG2K=ON\n");
+		}
+	}
+	return false;
+}
+
+// reads the header of the file up to the PixelData
+bool ReadDicomHeader(Slice& slice) {
 
 	DcmFileFormat fileFormat;
-	assert((cnd = fileFormat.loadFile(file.c_str())).good());
+	OFCondition cnd = fileFormat.loadFileUntilTag(slice.file.c_str(), EXS_Unknown, EGL_noChange, 
+		DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData);
+	if (cnd.bad()) {
+		printf("Failed to read %s (%s)\n", slice.file.c_str(), cnd.text());
+		return false;
+	}
 	DcmDataset* dataset = fileFormat.getDataset();
 
-	double sx;
-	double sy;
-	double th;
-	cnd = dataset->findAndGetFloat64(DCM_PixelSpacing, sx, 0);
-	cnd = dataset->findAndGetFloat64(DCM_PixelSpacing, sy, 1);
-	cnd = dataset->findAndGetFloat64(DCM_SliceThickness, th, 0);
+	dataset->findAndGetFloat64(DCM_PixelSpacing, slice.spacingX, 0);
+	dataset->findAndGetFloat64(DCM_PixelSpacing, slice.spacingY, 1);
+	dataset->findAndGetFloat64(DCM_SliceThickness, slice.thickness, 0);
+	dataset->findAndGetFloat64(DCM_SliceLocation, slice.location, 0);
+
+	Sint32 temporalPosition = -1, acquisitionNumber = -1;
+	if (dataset->findAndGetSint32(DCM_TemporalPositionIdentifier, temporalPosition).good()) {
+		slice.temporalPosition = temporalPosition;
+	}
+	dataset->findAndGetFloat64(DCM_TriggerTime, slice.triggerTime);
+	if (dataset->findAndGetSint32(DCM_AcquisitionNumber, acquisitionNumber).good()) {
+		slice.acquisitionNumber = acquisitionNumber;
+	}
 
-	spacingX = std::max(sx, spacingX);
-	spacingY = std::max(sy, spacingY);
-	thickness = std::max(th, thickness);
+	Uint16 rows = 0, columns = 0, bits = 16;
+	dataset->findAndGetUint16(DCM_Rows, rows);
+	dataset->findAndGetUint16(DCM_Columns, columns);
+	dataset->findAndGetUint16(DCM_BitsStored, bits);
+	slice.width = columns;
+	slice.height = rows;
+	slice.bitsStored = bits;
+
+	// check if the raw pixel path can be used
+	Uint16 samples = 1, bitsAllocated = 0, highBit = 0, pixelRepresentation = 0;
+	Sint32 numFrames = 1;
+	OFString photometric;
+	dataset->findAndGetUint16(DCM_SamplesPerPixel, samples);
+	dataset->findAndGetUint16(DCM_BitsAllocated, bitsAllocated);
+	dataset->findAndGetUint16(DCM_HighBit, highBit);
+	dataset->findAndGetUint16(DCM_PixelRepresentation, pixelRepresentation);
+	dataset->findAndGetSint32(DCM_NumberOfFrames, numFrames);
+	dataset->findAndGetOFString(DCM_PhotometricInterpretation, photometric);
+	dataset->findAndGetFloat64(DCM_RescaleSlope, slice.slope);
+	dataset->findAndGetFloat64(DCM_RescaleIntercept, slice.intercept);
+
+	E_TransferSyntax xfer = dataset->getOriginalXfer();
+	if (!HasDecoder(xfer)) {
+		return false;
+	}
+	slice.numFrames = (unsigned long)std::max(numFrames, 1);
+	slice.isSigned = (pixelRepresentation == 1);
+	slice.rawPixels = (xfer == EXS_LittleEndianExplicit || xfer == EXS_LittleEndianImplicit)
+		&& samples == 1 && bitsAllocated == 16 && bits >= 1 && bits <= 16 && highBit == bits - 1
+		&& numFrames <= 1 && photometric == "MONOCHROME2" && slice.slope != 0.0
+		&& !dataset->tagExists(DCM_ModalityLUTSequence);
+
+	return true;
+}
 
-	cnd = dataset->findAndGetFloat64(DCM_SliceLocation, x, 0);
+// splits a time series into phases by the first key every slice has that gives at least
+// two phases with the same number of slices and the same slice locations, returns the 
+// number of phases (1 if no key does)
+unsigned int GroupPhases(vector<Slice>& slices) {
+
+	double Slice::* keys[] = { &Slice::temporalPosition, &Slice::triggerTime, &Slice::acquisitionNumber };
+	for (double Slice::* key : keys) {
+		std::map<double, unsigned int> counts;
+		bool complete = true;
+		for (const Slice& slice : slices) {
+			if (slice.*key < 0.0) {
+				complete = false;
+				break;
+			}
+			counts[slice.*key]++;
+		}
+		if (!complete || counts.size() < 2) {
+			continue;
+		}
+		unsigned int slicesPerPhase = counts.begin()->second;
+		bool equal = std::all_of(counts.begin(), counts.end(), [&](const std::pair<const double, unsigned int>& count) {
+			return count.second == slicesPerPhase;
+			});
+		if (!equal) {
+			continue;
+		}
 
-	img = new DicomImage(file.c_str());
-	assert(img != NULL);
-	assert(img->getStatus() == EIS_Normal);
+		// phases are numbered in key order
+		unsigned int phase = 0;
+		for (auto& count : counts) {
+			count.second = phase++;
+		}
+		vector<std::set<double>> locations(counts.size());
+		for (Slice& slice : slices) {
+			slice.phase = counts[slice.*key];
+			locations[slice.phase].insert(slice.location);
+		}
+		if (std::all_of(locations.begin(), locations.end(), [&](const std::set<double>& phaseLocations) {
+			return phaseLocations == locations[0];
+			})) {
+			return (unsigned int)counts.size();
+		}
+	}
+
+	for (Slice& slice : slices) {
+		slice.phase = 0;
+	}
+	return 1;
 }
 
-void ReadDicomImage(DicomImage* img, uint16_t* slice, int w, int h) {
-	img->setMinMaxWindow();
-	uint16_t* pixelData = (uint16_t*)img->getOutputData(16);
-	memcpy(slice, pixelData, sizeof(uint16_t) * w * h);
+// reads the PixelData straight from the mapped file and applies the rescale slope/intercept
+// and a min-max window, the same values DicomImage renders
+bool ReadRawPixels(Slice& slice, uint16_t* data) {
+
+	MappedFile file;
+	if (!file.Open(slice.file)) {
+		return false;
+	}
+	size_t count = (size_t)slice.width * slice.height;
+	const uint16_t* raw = FindPixelData(file.GetData(), file.GetSize(), (uint32_t)(count * sizeof(uint16_t)));
+	if (!raw) {
+		return false;
+	}
+
+	// range of the modality values (stored * slope + intercept)
+	int minStored, maxStored;
+	RawMinMax(raw, count, slice.bitsStored, slice.isSigned, minStored, maxStored);
+	slice.minVal = minStored * slice.slope + slice.intercept;
+	slice.maxVal = maxStored * slice.slope + slice.intercept;
+	if (slice.slope < 0.0) {
+		std::swap(slice.minVal, slice.maxVal);
+	}
+
+	// min-max window: (value - min) / (max - min) * 65535, a flat slice is all 0
+	double range = slice.maxVal - slice.minVal;
+	float scale = (range > 0.0) ? (float)(slice.slope * 65535.0 / range) : 0.0f;
+	float offset = (range > 0.0) ? (float)((slice.intercept - slice.minVal) * 65535.0 / range) : 0.0f;
+	RawToWindowed(raw, count, slice.bitsStored, slice.isSigned, scale, offset, data);
+
+	return true;
 }
 
-void ReadDicomImages(uint16_t* data, vector<Slice>& images, int start, int end, int w, int h) {
+// registers the DCMTK decoders for the compressed transfer syntaxes (JPEG, JPEG-LS, RLE
+// and JPEG 2000 when built with fmjpeg2k), DicomImage then decodes them transparently
+void RegisterCodecs() {
+	static std::once_flag registered;
+	std::call_once(registered, []() {
+		DJDecoderRegistration::registerCodecs();
+		DJLSDecoderRegistration::registerCodecs();
+		DcmRLEDecoderRegistration::registerCodecs();
+#ifdef CLAHE_HAVE_FMJPEG2K
+		FMJPEG2KDecoderRegistration::registerCodecs();
+#endif
+	});
+}
 
-	for (int sliceID = start; sliceID < end; sliceID++) {
-		if (sliceID >= (int)images.size()) 
-			break;
-		//printf("slice: %d, adding: %d\n", sliceID, (sliceID * w * h));
-		ReadDicomImage(images[sliceID].image, data + sliceID * w * h, w, h);
+// opens the file and decodes just the slice's frame, the windowed 16 bit pixels are 
+// rendered straight into data
+bool ReadDicomImage(Slice& slice, uint16_t* data) {
+
+	// uncompressed slices skip the DicomImage rendering
+	if (slice.rawPixels && ReadRawPixels(slice, data)) {
+		return true;
 	}
+
+	// partial access only decompresses the requested frame of multi-frame files
+	DicomImage image(slice.file.c_str(), CIF_UsePartialAccessToPixelData, slice.frame, 1);
+	if (image.getStatus() != EIS_Normal) {
+		printf("Failed to decode %s (%s)\n", slice.file.c_str(), DicomImage::getString(image.getStatus()));
+		return false;
+	}
+	if (image.getWidth() != slice.width || image.getHeight() != slice.height) {
+		printf("Skipping %s - size does not match the header\n", slice.file.c_str());
+		return false;
+	}
+
+	// Get the Min/Max values for the Dicom Image
+	int mode = 0;	// mode = used pixel values vs 1 = possible pixelvalues
+	image.getMinMaxValues(slice.minVal, slice.maxVal, mode);
+
+	// render into the caller's buffer so DCMTK does not allocate its own output copy
+	image.setMinMaxWindow();
+	return image.getOutputData(data, sizeof(uint16_t) * slice.width * slice.height, 16) != 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -184,15 +703,16 @@ GLuint ImageLoader::loadDicomImage() {
 	printf("Loading Dicom file: %s\n", _path.c_str());
 
 	// Get information
-	DicomImage* image = nullptr;
-	double x = 0.0;
-	double spacingX = 0.0;
-	double spacingY = 0.0;
-	double thickness = 0.0;
-	ReadDicomSlice(image, x, _path, spacingX, spacingY, thickness);
+	RegisterCodecs();
+	Slice slice;
+	slice.file = _path;
+	if (!ReadDicomHeader(slice)) {
+		return 0;
+	}
+	_bitsStored = slice.bitsStored;
 
-	unsigned int w = image->getWidth();
-	unsigned int h = image->getHeight();
+	unsigned int w = slice.width;
+	unsigned int h = slice.height;
 	unsigned int d = 1;
 
 	_imgDims.x = w;
@@ -200,25 +720,19 @@ GLuint ImageLoader::loadDicomImage() {
 	_imgDims.z = d;
 
 	// volume size in meters
-	_size.x = .001f * (float)spacingX * w;
-	_size.y = .001f * (float)spacingY * h;
-	_size.z = .001f * (float)thickness;
+	_size.x = .001f * (float)slice.spacingX * w;
+	_size.y = .001f * (float)slice.spacingY * h;
+	_size.z = .001f * (float)slice.thickness;
 
 	_imageData = new uint16_t[w * h * d];
-	memset(_imageData, 0xFF, w * h * d * sizeof(uint16_t));
-	ReadDicomImage(image, _imageData, w, h);
+	if (!ReadDicomImage(slice, _imageData)) {
+		memset(_imageData, 0xFF, w * h * d * sizeof(uint16_t));
+	}
 
-	// get the raw data 
-	//_dataTest = (uint16_t*)_imageData; 
-	//_dataTest = (uint16_t*)image->getOutputData(16);
-	//_dataTest = (uint16_t*)image->getInterData();
+	_minPixelVal = slice.minVal;
+	_maxPixelVal = slice.maxVal;
 
-	// Get the Min/Max values for the Dicom Image
-	int mode = 0;	// mode = used pixel values vs 1 = possible pixelvalues
-	image->getMinMaxValues(_minPixelVal, _maxPixelVal, mode);
-
-	GLuint tex = InitTexture2D(w, h, GL_R16, GL_RED, GL_UNSIGNED_SHORT, GL_LINEAR, _imageData);
-	//delete[] data;
+	GLuint tex = _useGL ? InitTexture2D(w, h, GL_R16, GL_RED, GL_UNSIGNED_SHORT, GL_LINEAR, _imageData) : 0;
 	cerr << "Dicom loaded: (" << tex << ")\n\n";
 	return tex;
 }
@@ -227,62 +741,236 @@ GLuint ImageLoader::loadDicomVolume(const vector<string>& files) {
 
 	std::cerr << "Loading DICOM Folder\n";
 
-	vector<Slice> images;
+	RegisterCodecs();
+	ThreadPool pool(_numThreads);
+	unsigned int numFiles = (unsigned int)files.size();
+
+	// read the headers in parallel, one task per file
+	vector<Slice> slices(numFiles);
+	vector<char> valid(numFiles, 0);
+	pool.ParallelFor(numFiles, [&](unsigned int begin, unsigned int end, unsigned int) {
+		for (unsigned int i = begin; i < end; i++) {
+			slices[i].file = files[i];
+			valid[i] = ReadDicomHeader(slices[i]);
+		}
+	}, numFiles);
+
+	// drop the unreadable files and split multi-frame files into one slice per frame,
+	// then sort by slice location (frames of a file stay in order)
+	unsigned int numSlices = 0;
+	for (unsigned int i = 0; i < numFiles; i++) {
+		if (valid[i]) {
+			slices[numSlices++] = std::move(slices[i]);
+		}
+	}
+	slices.resize(numSlices);
+	for (unsigned int i = 0; i < numSlices; i++) {
+		for (unsigned long frame = 1; frame < slices[i].numFrames; frame++) {
+			Slice frameSlice = slices[i];
+			frameSlice.frame = frame;
+			slices.push_back(frameSlice);
+		}
+	}
+	if (slices.empty()) {
+		return 0;
+	}
+
+	// every slice is decoded into a slot of the volume's size, so slices with other
+	// Rows/Columns (ie. a scout or localizer) are dropped - the most common size wins
+	std::map<std::pair<unsigned int, unsigned int>, unsigned int> sizeCounts;
+	for (const Slice& slice : slices) {
+		sizeCounts[{ slice.width, slice.height }]++;
+	}
+	std::pair<unsigned int, unsigned int> volumeSize = std::max_element(sizeCounts.begin(), sizeCounts.end(), 
+		[](const std::pair<const std::pair<unsigned int, unsigned int>, unsigned int>& a, 
+			const std::pair<const std::pair<unsigned int, unsigned int>, unsigned int>& b) {
+			return a.second < b.second;
+		})->first;
+	slices.erase(std::remove_if(slices.begin(), slices.end(), [&](const Slice& slice) {
+		if (slice.width == volumeSize.first && slice.height == volumeSize.second) {
+			return false;
+		}
+		printf("Skipping %s frame %lu (%dx%d, the volume is %dx%d)\n", slice.file.c_str(), slice.frame, 
+			slice.width, slice.height, volumeSize.first, volumeSize.second);
+		return true;
+		}), slices.end());
+
+	// time series share slice locations -> one volume per phase, stored one after another
+	unsigned int numPhases = GroupPhases(slices);
+	std::sort(slices.begin(), slices.end(), [](const Slice& a, const Slice& b) {
+		if (a.phase != b.phase) return a.phase < b.phase;
+		if (a.location != b.location) return a.location < b.location;
+		if (a.file != b.file) return a.file < b.file;
+		return a.frame < b.frame;
+		});
 
 	// Get information
 	double spacingX = 0.0;
 	double spacingY = 0.0;
 	double thickness = 0.0;
-
-	for (unsigned int i = 0; i < (int)files.size(); i++) {
-		DicomImage* img;
-		double x;
-		ReadDicomSlice(img, x, files[i], spacingX, spacingY, thickness);
-		images.push_back({ img, x });
+	_bitsStored = 0;
+	for (const Slice& slice : slices) {
+		spacingX = std::max(slice.spacingX, spacingX);
+		spacingY = std::max(slice.spacingY, spacingY);
+		thickness = std::max(slice.thickness, thickness);
+		_bitsStored = std::max(slice.bitsStored, _bitsStored);
 	}
 
-	std::sort(images.begin(), images.end(), [](const Slice& a, const Slice& b) {
-		return a.location < b.location;
-		});
-
-	unsigned int w = images[0].image->getWidth();
-	unsigned int h = images[0].image->getHeight();
-	unsigned int d = (unsigned int)images.size();
+	unsigned int w = slices[0].width;
+	unsigned int h = slices[0].height;
+	numSlices = (unsigned int)slices.size();
+	unsigned int d = numSlices / numPhases;
 
 	_imgDims.x = w;
 	_imgDims.y = h;
 	_imgDims.z = d;
+	_numPhases = numPhases;
 
 	// volume size in meters
 	_size.x = .001f * (float)spacingX * w;
 	_size.y = .001f * (float)spacingY * h;
-	_size.z = .001f * (float)thickness * images.size();
-
-	printf("%fm x %fm x %fm\n", _size.x, _size.y, _size.z);
+	_size.z = .001f * (float)thickness * d;
+
+	printf("%fm x %fm x %fm, %d phase(s)\n", _size.x, _size.y, _size.z, numPhases);
+
+	// decode straight into a persistently mapped unpack buffer when uploading to GL,
+	// otherwise into the host copy (no memset, every slice is written by its decode)
+	size_t volumeBytes = (size_t)w * h * numSlices * sizeof(uint16_t);
+	GLuint unpackBuffer = 0;
+	uint16_t* volume = nullptr;
+	if (_useGL && GLEW_ARB_buffer_storage) {
+		GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &unpackBuffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, volumeBytes, nullptr, flags);
+		volume = (uint16_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, volumeBytes, flags);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (!volume) {
+			glDeleteBuffers(1, &unpackBuffer);
+			unpackBuffer = 0;
+		}
+	}
+	if (!volume) {
+		_imageData = new uint16_t[(size_t)w * h * numSlices];
+		volume = _imageData;
+	}
 
-	_imageData = new uint16_t[w * h * d];
-	memset(_imageData, 0xFFFF, w * h * d * sizeof(uint16_t));
+	// texture storage is allocated up front and filled in slabs as the slices decode
+	_phaseTextures.assign(numPhases, 0);
+	if (_useGL) {
+		for (GLuint& phaseTexture : _phaseTextures) {
+			phaseTexture = InitTextureStorage3D(w, h, d, GL_R16, GL_LINEAR);
+		}
+	}
 
-	if (THREAD_COUNT > 1) {
-		printf("reading %d slices\n", d);
-		vector<thread> threads;
-		int s = ((int)images.size() + THREAD_COUNT - 1) / THREAD_COUNT;
+	// decode every file exactly once, straight into its slice of the volume
+	// - each DicomImage is freed as soon as its slice is written
+	// - the files PREFETCH_FILES ahead are read in the background while these decode
+	// - all phases share the pool so they decode in parallel
+	printf("reading %d slices\n", numSlices);
+	for (unsigned int i = 0; i < std::min(numSlices, (unsigned int)PREFETCH_FILES); i++) {
+		PrefetchFile(slices[i].file);
+	}
+	std::atomic<unsigned int> numFailed(0);
+	SliceQueue decoded(numSlices);
+	for (unsigned int i = 0; i < numSlices; i++) {
+		pool.Enqueue([&, i]() {
+			if (i + PREFETCH_FILES < numSlices) {
+				PrefetchFile(slices[i + PREFETCH_FILES].file);
+			}
+			uint16_t* slice = volume + (size_t)i * w * h;
+			if (!ReadDicomImage(slices[i], slice)) {
+				memset(slice, 0xFF, w * h * sizeof(uint16_t));
+				slices[i].minVal = std::numeric_limits<double>::max();
+				slices[i].maxVal = std::numeric_limits<double>::lowest();
+				numFailed++;
+			}
+			decoded.Push(i);
+		});
+	}
 
-		// each thread processes s slices 
-		for (int i = 0; i < (int)images.size(); i += s) {
-			threads.push_back(thread(ReadDicomImages, _imageData, images, i, i + s, w, h));
+	// upload runs of decoded slices while the workers continue, runs shorter than
+	// SLAB_SLICES wait for their neighbours until every slice has been decoded
+	// - runs never cross into the next phase's texture
+	if (_useGL) {
+		enum { WAITING, DECODED, UPLOADED };
+		vector<char> state(numSlices, WAITING);
+		unsigned int numUploaded = 0;
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		if (unpackBuffer) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
 		}
-
-		for (int i = 0; i < (int)threads.size(); i++) {
-			threads[i].join();
+		while (numUploaded < numSlices) {
+			for (int slice = decoded.Pop(); slice >= 0; slice = decoded.Pop()) {
+				state[slice] = DECODED;
+			}
+
+			unsigned int prevUploaded = numUploaded;
+			for (unsigned int begin = 0; begin < numSlices; ) {
+				if (state[begin] != DECODED) {
+					begin++;
+					continue;
+				}
+				unsigned int phaseEnd = (begin / d + 1) * d;
+				unsigned int end = begin;
+				while (end < phaseEnd && state[end] == DECODED) end++;
+
+				if (end - begin >= SLAB_SLICES || decoded.Done()) {
+					// offset into the unpack buffer or pointer into the host copy
+					size_t offset = (size_t)begin * w * h;
+					const void* src = unpackBuffer ? (const void*)(offset * sizeof(uint16_t)) : (const void*)(_imageData + offset);
+					glBindTexture(GL_TEXTURE_3D, _phaseTextures[begin / d]);
+					glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, begin % d, w, h, end - begin, GL_RED, GL_UNSIGNED_SHORT, src);
+					std::fill(state.begin() + begin, state.begin() + end, (char)UPLOADED);
+					numUploaded += end - begin;
+				}
+				begin = end;
+			}
+
+			if (numUploaded == prevUploaded && !decoded.Done()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		if (unpackBuffer) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 		}
+		glBindTexture(GL_TEXTURE_3D, 0);
 	}
-	else {
-		ReadDicomImages(_imageData, images, 0, (int)images.size(), w, h);
+	pool.Wait();
+
+	// range of the stored values across every phase
+	_minPixelVal = std::numeric_limits<double>::max();
+	_maxPixelVal = std::numeric_limits<double>::lowest();
+	for (const Slice& slice : slices) {
+		_minPixelVal = std::min(slice.minVal, _minPixelVal);
+		_maxPixelVal = std::max(slice.maxVal, _maxPixelVal);
+	}
+	printf("BitsStored: %d, range: [%.0f, %.0f]\n", _bitsStored, _minPixelVal, _maxPixelVal);
+
+	// a volume with undecodable slices is not cached, so the next load tries them again
+	if (_useCache && numFailed > 0) {
+		printf("%d slices failed to decode, %s is not written\n", numFailed.load(), GetCachePath(_path).c_str());
+	}
+	else if (_useCache) {
+		CacheHeader header = MakeCacheHeader(_imgDims, _size, sizeof(uint16_t));
+		header.bitsStored = _bitsStored;
+		header.minVal = _minPixelVal;
+		header.maxVal = _maxPixelVal;
+		header.numPhases = numPhases;
+		WriteCache(GetCachePath(_path), files, header, volume);
+	}
+
+	// the texture holds the volume now, GL keeps the buffer alive until the upload is done
+	if (unpackBuffer) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(1, &unpackBuffer);
 	}
 
-	GLuint tex = InitTexture3D(w, h, d, GL_R16, GL_RED, GL_UNSIGNED_SHORT, GL_LINEAR, _imageData);
-	printf("Dicom Volume loaded: (%d)\n\n", tex);
+	GLuint tex = _phaseTextures[0];
+	printf("Dicom Volume loaded: (%d) - peak RSS %.1f MB\n\n", tex, GetPeakRSS() / 1048576.0);
 	return tex;
 }
 
@@ -290,9 +978,7 @@ GLuint ImageLoader::loadDicomVolume(const vector<string>& files) {
 // Image/Volume Loaders 
 
 GLuint ImageLoader::loadImage() {
-#ifdef WIN32
-	if (!PathFileExists(_path.c_str())) {
-#endif
+	if (!FileExists(_path)) {
 		printf("%s Does not exist!\n", _path.c_str());
 		return 0;
 	}
@@ -305,9 +991,7 @@ GLuint ImageLoader::loadImage() {
 }
 
 GLuint ImageLoader::loadVolume() {
-#ifdef WIN32
-	if (!PathFileExists(_path.c_str())) {
-#endif
+	if (!FileExists(_path)) {
 		printf("%s Does not exist!\n", _path.c_str());
 		return 0;
 	}
@@ -318,19 +1002,42 @@ GLuint ImageLoader::loadVolume() {
 	if (files.size() == 0) return 0;
 
 	string ext = GetExt(files[0]);
-	if (ext == "dcm")
-		return loadDicomVolume(files);
-	else
+	if (ext != "dcm")
 		return 0;
+
+	// re-open an unchanged folder from its cache
+	string cachePath = GetCachePath(_path);
+	if (_useCache) {
+		if (const CacheHeader* header = OpenCache(cachePath, files, sizeof(uint16_t), _volumeCache)) {
+			_imgDims = glm::uvec3(header->dims[0], header->dims[1], header->dims[2]);
+			_size = glm::vec3(header->size[0], header->size[1], header->size[2]);
+			_bitsStored = header->bitsStored;
+			_minPixelVal = header->minVal;
+			_maxPixelVal = header->maxVal;
+			_numPhases = header->numPhases;
+			_cachedData = (const uint16_t*)(header + 1);
+
+			_phaseTextures.assign(_numPhases, 0);
+			if (_useGL) {
+				for (unsigned int phase = 0; phase < _numPhases; phase++) {
+					_phaseTextures[phase] = InitTexture3D(_imgDims.x, _imgDims.y, _imgDims.z, GL_R16, GL_RED, GL_UNSIGNED_SHORT,
+						GL_LINEAR, GetImageData(phase));
+				}
+			}
+			GLuint tex = _phaseTextures[0];
+			printf("Dicom Volume loaded from %s: (%d), %d phase(s)\n\n", cachePath.c_str(), tex, _numPhases);
+			return tex;
+		}
+	}
+
+	return loadDicomVolume(files);
 }
 
 GLuint ImageLoader::loadMask() {
 
 	std::cerr << "Loading Mask Folder\n";
 
-#ifdef  WIN32
-	if (!PathFileExists(_maskPath.c_str())) {
-#endif 
+	if (!FileExists(_maskPath)) {
 		printf("%s Does not exist!\n\n", _maskPath.c_str());
 		return 0;
 	}
@@ -342,34 +1049,80 @@ GLuint ImageLoader::loadMask() {
 		return atoi(GetName(a).c_str()) > atoi(GetName(b).c_str());
 	});
 
-	int width, height, channel;
-	unsigned char* maskData = new unsigned char[_imgDims.x * _imgDims.y * _imgDims.z];
-	memset(maskData, 0, _imgDims.x * _imgDims.y * _imgDims.z * sizeof(unsigned char));
-	for (int currSlice = 0; currSlice < files.size(); currSlice++) {
-
-		//stbi_set_flip_vertically_on_load(true);
-		unsigned char* pixelData = stbi_load(files.at(currSlice).c_str(), &width, &height, &channel, STBI_grey);
-		
-		unsigned char* slice = maskData + (currSlice * _imgDims.x * _imgDims.y);
-		memcpy(slice, pixelData, sizeof(unsigned char) * _imgDims.x * _imgDims.y);
+	// the mask is kept run-length encoded and only expanded a slab at a time
+	unsigned int w = _imgDims.x, h = _imgDims.y, d = _imgDims.z;
+	_mask.Init(_imgDims);
+	ThreadPool pool(_numThreads);
+
+	// re-open an unchanged mask folder from its cache
+	string cachePath = GetCachePath(_maskPath);
+	bool fromCache = false;
+	MappedFile cache;
+	if (_useCache) {
+		const CacheHeader* header = OpenCache(cachePath, files, sizeof(unsigned char), cache);
+		if (header && _imgDims == glm::uvec3(header->dims[0], header->dims[1], header->dims[2])) {
+			const unsigned char* voxels = (const unsigned char*)(header + 1);
+			pool.ParallelFor(d, [&](unsigned int begin, unsigned int end, unsigned int) {
+				for (unsigned int z = begin; z < end; z++) {
+					_mask.EncodeSlice(z, voxels + (size_t)z * w * h);
+				}
+			});
+			fromCache = true;
+		}
+	}
 
-		stbi_image_free(pixelData);
+	// decode the slices in parallel, one task per file
+	if (!fromCache) {
+		unsigned int numSlices = std::min((unsigned int)files.size(), d);
+		pool.ParallelFor(numSlices, [&](unsigned int begin, unsigned int end, unsigned int) {
+			for (unsigned int z = begin; z < end; z++) {
+				//stbi_set_flip_vertically_on_load(true);
+				int width, height, channel;
+				unsigned char* pixelData = stbi_load(files[z].c_str(), &width, &height, &channel, STBI_grey);
+				if (!pixelData || width != (int)w || height != (int)h) {
+					printf("Skipping mask %s - could not be read or size does not match\n", files[z].c_str());
+				}
+				else {
+					_mask.EncodeSlice(z, pixelData);
+				}
+				stbi_image_free(pixelData);
+			}
+		}, numSlices);
 	}
+	cache.Close();
+
+	// make volume texture for the mask data, expanding SLAB_SLICES slices at a time
+	GLuint tex = 0;
+	if (_useGL) {
+		tex = InitTextureStorage3D(w, h, d, GL_R8, GL_LINEAR);
+		vector<unsigned char> slab((size_t)SLAB_SLICES * w * h);
+
+		glBindTexture(GL_TEXTURE_3D, tex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (unsigned int begin = 0; begin < d; begin += SLAB_SLICES) {
+			unsigned int end = std::min(begin + SLAB_SLICES, d);
+			_mask.DecodeSlices(begin, end, slab.data());
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, begin, w, h, end - begin, GL_RED, GL_UNSIGNED_BYTE, slab.data());
+		}
+		glBindTexture(GL_TEXTURE_3D, 0);
+	}
+	printf("Masks loaded%s: (%d) - (%d, %d, %d), %.1f MB encoded\n\n", fromCache ? " from cache" : "", tex, 
+		w, h, d, _mask.GetSizeBytes() / 1048576.0);
 
-	// make volume texture for the mask data 
-	
-	GLuint tex = InitTexture3D(_imgDims.x, _imgDims.y, _imgDims.z, GL_R8, GL_RED, GL_UNSIGNED_BYTE, GL_LINEAR, maskData);
-	printf("Masks loaded: (%d) - (%d, %d, %d)\n\n", tex, _imgDims.x, _imgDims.y, _imgDims.z);
-	delete[] maskData;
+	if (_useCache && !fromCache) {
+		WriteCache(cachePath, files, MakeCacheHeader(_imgDims, _size, sizeof(unsigned char)), 
+			[&](unsigned int z, void* dst) { _mask.DecodeSlices(z, z + 1, (unsigned char*)dst); });
+	}
 	return tex;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Constructor/Destructor
 
-ImageLoader::ImageLoader(string& path, string& maskpath, bool isImg) {
+ImageLoader::ImageLoader(const string& path, const string& maskpath, bool isImg, bool useGL) {
 
 	_path = path;	_maskPath = maskpath;
+	_useGL = useGL;
 
 	if (isImg) {
 		cerr << "Load Image\n";
@@ -383,7 +1136,35 @@ ImageLoader::ImageLoader(string& path, string& maskpath, bool isImg) {
 }
 
 ImageLoader::~ImageLoader() {
+	ReleaseImageData();
+}
+
+void ImageLoader::ReleaseImageData() {
 	delete[] _imageData;
+	_imageData = nullptr;
+	_volumeCache.Close();
+	_cachedData = nullptr;
+	_mask.Clear();
+}
+
+size_t ImageLoader::GetPeakRSS() {
+#ifdef WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (size_t)counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;			// bytes
+#else
+	return (size_t)usage.ru_maxrss * 1024;	// kilobytes
+#endif
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
\ No newline at end of file
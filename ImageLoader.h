@@ -4,13 +4,16 @@
 
 #pragma once
 
-#include <gl/glew.h>
+#include <GL/glew.h>
 #include <glm/glm.hpp>
 
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "MappedFile.h"
+#include "RLEMask.h"
+
 
 // Win32 LoadImage macro
 #ifdef LoadImage
@@ -25,14 +28,23 @@ private:
 	
 	// Image Properties 
 	string _path, _maskPath;
-	uint16_t* _imageData; 
+	uint16_t* _imageData = nullptr; 
+	MappedFile _volumeCache;					// mapped <folder>.clahe cache
+	const uint16_t* _cachedData = nullptr;		// volume inside _volumeCache
+	RLEMask _mask;								// host copy of the mask
 	uint16_t* _dataTest;
 	glm::vec3 _size;
-	glm::uvec3 _imgDims;
-	double _minPixelVal, _maxPixelVal;
+	glm::uvec3 _imgDims = glm::uvec3(0);
+	double _minPixelVal = 0.0, _maxPixelVal = 0.0;
+	unsigned int _bitsStored = 16;
+	unsigned int _numPhases = 1;				// phases of a time series
 
 	// texture ID
-	GLuint _textureID, _maskID;
+	GLuint _textureID = 0, _maskID = 0;
+	vector<GLuint> _phaseTextures;				// one volume per phase, _textureID is phase 0
+	bool _useGL = true;		// false -> only keep the host copy (no GL context)
+	static bool _useCache;
+	static unsigned int _numThreads;
 
 	// Dicom Loaders
 	GLuint loadDicomImage();
@@ -45,7 +57,7 @@ private:
 
 public:
 
-	ImageLoader(string& path, string&maskpath= string(""), bool isImg=true);
+	ImageLoader(const string& path, const string& maskpath = string(""), bool isImg = true, bool useGL = true);
 	~ImageLoader();
 
 	// Getters
@@ -53,7 +65,31 @@ public:
 	GLuint GetMaskID()				{ return _maskID; }
 	glm::vec3 GetSize()				{ return _size; }
 	glm::vec3 GetImageDimensions()	{ return _imgDims; }
-	uint16_t* GetImageData()		{ return _imageData; }
+	// host copy of the volume - only kept without GL (useGL = false), when the GL upload
+	// cannot decode into an unpack buffer, or when loaded from the cache
+	const uint16_t* GetImageData(unsigned int phase = 0) {
+		const uint16_t* data = _cachedData ? _cachedData : _imageData;
+		return data ? data + (size_t)phase * _imgDims.x * _imgDims.y * _imgDims.z : nullptr;
+	}
 	double GetMinPixelValue()		{ return _minPixelVal; }
 	double GetMaxPixelValue()		{ return _maxPixelVal; }
+	unsigned int GetBitsStored()	{ return _bitsStored; }
+	const RLEMask& GetMask()		{ return _mask; }
+
+	// Time series are loaded as one volume texture per phase
+	unsigned int GetNumPhases()		{ return _numPhases; }
+	GLuint GetPhaseTextureID(unsigned int phase) {
+		return phase < _phaseTextures.size() ? _phaseTextures[phase] : _textureID;
+	}
+
+	// Free the host copies of the volume and mask once only the textures are needed
+	void ReleaseImageData();
+
+	// Write/read the <folder>.clahe caches next to the volume and mask folders (default on)
+	static void SetUseCache(bool useCache)	{ _useCache = useCache; }
+	// Decode workers, 0 uses one per hardware thread (default)
+	static void SetNumThreads(unsigned int numThreads)	{ _numThreads = numThreads; }
+
+	// Peak resident memory of the process (bytes)
+	static size_t GetPeakRSS();
 };
\ No newline at end of file
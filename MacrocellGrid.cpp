@@ -0,0 +1,136 @@
+////////////////////////////////////////
+// MacrocellGrid.cpp
+////////////////////////////////////////
+
+#include "MacrocellGrid.h"
+#include "Shader.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructor/Destructor
+
+void MacrocellGrid::Init(int cellSize) {
+	_macrocellShader = LoadComputeShader("macrocell.comp");
+	_occupancyShader = LoadComputeShader("occupancy.comp");
+	_cellSize = cellSize;
+}
+
+MacrocellGrid::~MacrocellGrid() {
+	glDeleteProgram(_macrocellShader);
+	glDeleteProgram(_occupancyShader);
+
+	GLuint textures[3] = { _texture, _occupancyTexture, _maskCellTexture };
+	for (GLuint texture : textures) {
+		if (texture != 0) {
+			glDeleteTextures(1, &texture);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Macrocells
+
+void MacrocellGrid::Update(GLuint volumeTexture) {
+
+	if (volumeTexture == _volumeTexture) {
+		return;
+	}
+	_volumeTexture = volumeTexture;
+
+	// the grid only changes size with the volume, CLAHE results re-use it
+	glm::ivec3 volDims = getTextureDims(volumeTexture);
+	glm::ivec3 numCells = (volDims + _cellSize - 1) / _cellSize;
+	if (volDims != _volDims) {
+		if (_texture != 0) {
+			glDeleteTextures(1, &_texture);
+		}
+		_volDims = volDims;
+		_texture = createTexture(numCells, GL_RG16F, GL_NEAREST);
+	}
+
+	computeMacrocells(volumeTexture, _texture, numCells);
+}
+
+void MacrocellGrid::SetMask(GLuint maskTexture) {
+
+	if (maskTexture == _maskTexture) {
+		return;
+	}
+	_maskTexture = maskTexture;
+
+	GLuint textures[2] = { _occupancyTexture, _maskCellTexture };
+	glDeleteTextures(2, textures);
+	_occupancyTexture = _maskCellTexture = 0;
+	if (maskTexture == 0) {
+		return;
+	}
+
+	glm::ivec3 maskDims = getTextureDims(maskTexture);
+	glm::ivec3 numCells = (maskDims + _cellSize - 1) / _cellSize;
+	_occupancyTexture = createTexture(maskDims, GL_R8, GL_LINEAR);
+	_maskCellTexture = createTexture(numCells, GL_RG16F, GL_NEAREST);
+
+	// organ labels -> 0/1 occupancy
+	glUseProgram(_occupancyShader);
+	glBindImageTexture(0, maskTexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R8UI);
+	glBindImageTexture(1, _occupancyTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8);
+
+	glDispatchCompute(	(GLuint)((maskDims.x + 3) / 4),
+						(GLuint)((maskDims.y + 3) / 4),
+						(GLuint)((maskDims.z + 3) / 4));
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	glUseProgram(0);
+
+	// cells without any organ are skipped while the mask is shown
+	computeMacrocells(_occupancyTexture, _maskCellTexture, numCells);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Helper Functions
+
+GLuint MacrocellGrid::createTexture(glm::ivec3 dims, GLenum internalFormat, GLenum filter) {
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexStorage3D(GL_TEXTURE_3D, 1, internalFormat, dims.x, dims.y, dims.z);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	return texture;
+}
+
+glm::ivec3 MacrocellGrid::getTextureDims(GLuint texture) {
+
+	glm::ivec3 dims;
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_WIDTH, &dims.x);
+	glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_HEIGHT, &dims.y);
+	glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_DEPTH, &dims.z);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	return dims;
+}
+
+// min/max of sourceTexture per macrocell, one thread per macrocell
+void MacrocellGrid::computeMacrocells(GLuint sourceTexture, GLuint gridTexture, glm::ivec3 numCells) {
+
+	glUseProgram(_macrocellShader);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D, sourceTexture);
+	glUniform1i(glGetUniformLocation(_macrocellShader, "volume"), 0);
+	glBindImageTexture(0, gridTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG16F);
+	glUniform1i(glGetUniformLocation(_macrocellShader, "cellSize"), _cellSize);
+
+	glDispatchCompute(	(GLuint)((numCells.x + 3) / 4),
+						(GLuint)((numCells.y + 3) / 4),
+						(GLuint)((numCells.z + 3) / 4));
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_3D, 0);
+	glUseProgram(0);
+}
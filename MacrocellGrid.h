@@ -0,0 +1,46 @@
+////////////////////////////////////////
+// MacrocellGrid.h
+// Coarse min/max grids over the volume and mask the raymarcher uses to skip empty space
+////////////////////////////////////////
+
+#pragma once
+
+#include "core.h"
+
+class MacrocellGrid {
+private:
+
+	GLuint _macrocellShader = 0, _occupancyShader = 0;
+	int _cellSize = 8;				// voxels per macrocell along each axis
+
+	// Volume grid
+	GLuint _texture = 0;			// RG16F min/max per macrocell
+	GLuint _volumeTexture = 0;		// volume the grid was built from
+	glm::ivec3 _volDims = glm::ivec3(0);
+
+	// Mask grid
+	GLuint _occupancyTexture = 0;	// R8 mask occupancy, linear filtered
+	GLuint _maskCellTexture = 0;	// RG16F min/max occupancy per macrocell
+	GLuint _maskTexture = 0;		// mask the occupancy was built from
+
+	// Helper Functions
+	GLuint createTexture(glm::ivec3 dims, GLenum internalFormat, GLenum filter);
+	glm::ivec3 getTextureDims(GLuint texture);
+	void computeMacrocells(GLuint sourceTexture, GLuint gridTexture, glm::ivec3 numCells);
+
+public:
+	MacrocellGrid() {};
+	~MacrocellGrid();
+
+	void Init(int cellSize = 8);
+
+	// Rebuilds the volume grid when volumeTexture is not the volume it was built from
+	void Update(GLuint volumeTexture);
+	// Builds the occupancy texture and its grid, once per mask
+	void SetMask(GLuint maskTexture);
+
+	// Getters
+	GLuint GetTexture()				{ return _texture; }
+	GLuint GetOccupancyTexture()	{ return _occupancyTexture; }
+	GLuint GetMaskCellTexture()		{ return _maskCellTexture; }
+};
@@ -0,0 +1,99 @@
+////////////////////////////////////////
+// MappedFile.cpp
+////////////////////////////////////////
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructor/Destructor
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Open/Close
+
+bool MappedFile::Open(const std::string& path) {
+
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!data) {
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+	_mapping = mapping;
+	_size = (size_t)size.QuadPart;
+	_data = (const unsigned char*)data;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	// the mapping keeps the file alive, the descriptor is not needed
+	void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+	_size = (size_t)info.st_size;
+	_data = (const unsigned char*)data;
+#endif
+	return true;
+}
+
+void MappedFile::Close() {
+
+	if (!_data) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle((HANDLE)_mapping);
+	CloseHandle((HANDLE)_file);
+	_mapping = nullptr;
+	_file = nullptr;
+#else
+	munmap((void*)_data, _size);
+#endif
+	_data = nullptr;
+	_size = 0;
+}
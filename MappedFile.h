@@ -0,0 +1,32 @@
+////////////////////////////////////////
+// MappedFile.h
+// Read-only memory mapping of a whole file
+////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class MappedFile {
+private:
+	const unsigned char* _data = nullptr;
+	size_t _size = 0;
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#endif
+
+public:
+	MappedFile() {};
+	~MappedFile();
+
+	// Maps the file at path, returns false if it cannot be opened or is empty
+	bool Open(const std::string& path);
+	void Close();
+
+	// Getters
+	bool IsOpen()					{ return _data != nullptr; }
+	const unsigned char* GetData()	{ return _data; }
+	size_t GetSize()				{ return _size; }
+};
@@ -0,0 +1,78 @@
+////////////////////////////////////////
+// RLEMask.cpp
+////////////////////////////////////////
+
+#include "RLEMask.h"
+
+#include <algorithm>
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+// Init/Clear
+
+void RLEMask::Init(glm::uvec3 dims) {
+	_dims = dims;
+	_slices.assign(dims.z, std::vector<uint8_t>());
+}
+
+void RLEMask::Clear() {
+	_dims = glm::uvec3(0);
+	_slices.clear();
+	_slices.shrink_to_fit();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Encode/Decode
+
+void RLEMask::EncodeSlice(unsigned int z, const uint8_t* pixels) {
+
+	std::vector<uint8_t>& runs = _slices[z];
+	runs.clear();
+
+	// runs never cross a row and are at most 256 pixels long
+	for (unsigned int y = 0; y < _dims.y; y++) {
+		const uint8_t* row = pixels + (size_t)y * _dims.x;
+		for (unsigned int x = 0; x < _dims.x; ) {
+			uint8_t value = row[x];
+			unsigned int length = 1;
+			while (x + length < _dims.x && length < 256 && row[x + length] == value) {
+				length++;
+			}
+			runs.push_back(value);
+			runs.push_back((uint8_t)(length - 1));
+			x += length;
+		}
+	}
+	runs.shrink_to_fit();
+}
+
+void RLEMask::DecodeSlices(unsigned int begin, unsigned int end, uint8_t* dst) const {
+
+	size_t sliceSize = (size_t)_dims.x * _dims.y;
+	for (unsigned int z = begin; z < end; z++) {
+		const std::vector<uint8_t>& runs = _slices[z];
+
+		// slice that was never encoded -> empty
+		uint8_t* pixel = dst + (z - begin) * sliceSize;
+		if (runs.empty()) {
+			memset(pixel, 0, sliceSize);
+			continue;
+		}
+		for (size_t i = 0; i < runs.size(); i += 2) {
+			unsigned int length = (unsigned int)runs[i + 1] + 1;
+			memset(pixel, runs[i], length);
+			pixel += length;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Getters
+
+size_t RLEMask::GetSizeBytes() const {
+	size_t size = 0;
+	for (const std::vector<uint8_t>& runs : _slices) {
+		size += runs.size();
+	}
+	return size;
+}
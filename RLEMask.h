@@ -0,0 +1,33 @@
+////////////////////////////////////////
+// RLEMask.h
+// Run-length encoded organ mask, expanded one slab at a time for uploads
+////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class RLEMask {
+private:
+	glm::uvec3 _dims = glm::uvec3(0);
+	// per slice: (value, length - 1) byte pairs, the rows back to back
+	std::vector<std::vector<uint8_t>> _slices;
+
+public:
+	RLEMask() {};
+
+	void Init(glm::uvec3 dims);
+	void Clear();
+
+	// Encodes a dims.x * dims.y slice, different slices can be encoded concurrently
+	void EncodeSlice(unsigned int z, const uint8_t* pixels);
+	// Expands slices [begin, end) into dst (dims.x * dims.y bytes per slice)
+	void DecodeSlices(unsigned int begin, unsigned int end, uint8_t* dst) const;
+
+	// Getters
+	glm::uvec3 GetDims() const		{ return _dims; }
+	size_t GetSizeBytes() const;
+};
@@ -6,6 +6,9 @@
 #include "Shader.h"
 #include "ImageLoader.h"
 #include "ComputeCLAHE.h"
+#include "MacrocellGrid.h"
+#include "DynamicResolution.h"
+#include "TransferFunction.h"
 
 #include <stdio.h>
 #include <chrono>
@@ -35,6 +38,38 @@ glm::uvec3 numSB_3D = glm::uvec3(4, 4, 2);
 glm::uvec3 min3D = glm::uvec3(200, 200, 40);
 glm::uvec3 max3D = glm::uvec3(400, 400, 90);
 float clipLimit3D = 0.85f;
+unsigned int maxOutputGrayVals = 4096;	// cap on the number of histogram bins
+unsigned int currPhase = 0;				// phase of a time series being shown
+
+// Empty space skipping, rebuilt whenever the displayed texture changes, and the
+// filtered mask occupancy used by the organ view
+MacrocellGrid macrocells;
+// Offscreen volume pass, lower resolution while the camera moves
+DynamicResolution dynamicResolution;
+
+// Pre-integrated classification, larger steps for the same image
+TransferFunction transferFunction;
+bool usePreintegration = true;
+float tfDensity = 0.1f;			// opacity of the gray ramp per reference step
+
+// Redraw on demand - sleep until there is an event and only raymarch again when 
+// something that changes the frame did, otherwise the last frame is presented
+bool redrawOnDemand = true;
+struct FrameState {
+	glm::mat4 viewProject;
+	GLuint texture;
+	bool useMask, moving, usePreintegration;
+	unsigned int tfVersion;
+	int width, height;
+
+	bool operator==(const FrameState& other) const {
+		return viewProject == other.viewProject && texture == other.texture && useMask == other.useMask 
+			&& moving == other.moving && usePreintegration == other.usePreintegration 
+			&& tfVersion == other.tfVersion && width == other.width && height == other.height;
+	}
+};
+FrameState lastFrame;
+bool lastFrameValid = false;
 
 GLuint _currTexture;
 bool _useMask = false;
@@ -61,8 +96,8 @@ int MouseX, MouseY;
 
 int SceneManager::CreateWindow(const char* title, int width, int height) {
 
-	// 8x antialiasing
-	glfwWindowHint(GLFW_SAMPLES, 4);
+	// no multisampling, the volume is raymarched offscreen and upsampled to the window
+	glfwWindowHint(GLFW_SAMPLES, 0);
 	
 	// Window Variables 
 	_windowWidth = width;
@@ -94,8 +129,6 @@ int SceneManager::CreateWindow(const char* title, int width, int height) {
 	glfwSetCursorPosCallback(_window, CursorPositionCallback);
 	glfwSetWindowSizeCallback(_window, ResizeCallback);
 
-	glEnable(GL_MULTISAMPLE);
-
 	return 1;
 }
 
@@ -120,15 +153,21 @@ void SceneManager::InitScene() {
 	_dicomCube = new Cube();
 	std::string folderPath = std::string("C:/Users/kroth/Documents/UCSD/Grad/Thesis/clahe_2/Larry_2017");
 	std::string maskPath = std::string("C:/Users/kroth/Documents/UCSD/Grad/Thesis/clahe_2/Larry_2017/mask");
-	ImageLoader* _dicomVolume = new ImageLoader(folderPath, maskPath, false);
+	_dicomVolume = new ImageLoader(folderPath, maskPath, false);
 	glm::vec3 volDim = _dicomVolume->GetImageDimensions();
 	_dicomVolumeTexture = _dicomVolume->GetTextureID();
 	_dicomMaskTexture = _dicomVolume->GetMaskID();
+	printf("Phases: %d\n", _dicomVolume->GetNumPhases());
+	// the viewer only draws the textures
+	_dicomVolume->ReleaseImageData();
 
 	////////////////////////////////////////////////////////////////////////////
 	// 3D CLAHE with Compute Shaders
-	unsigned int outputGrayvals_3D = 65536;
+	// - the volume texture is 16 bit, the number of histogram bins follows the DICOM data
+	unsigned int outputGrayvals_3D = ComputeCLAHE::GetNumBins(_dicomVolume->GetBitsStored(), 
+		_dicomVolume->GetMinPixelValue(), _dicomVolume->GetMaxPixelValue(), maxOutputGrayVals);
 	unsigned int inputGrayvals_3D = 65536;
+	printf("Histogram bins: %d\n", outputGrayvals_3D);
 	unsigned int numOrgans = 4;
 
 	comp.Init(_dicomVolumeTexture, _dicomMaskTexture, volDim, outputGrayvals_3D, inputGrayvals_3D, numOrgans);
@@ -142,6 +181,11 @@ void SceneManager::InitScene() {
 	_textureMode = TextureMode::_RAW;
 	_interactionMode = InteractionMode::_MOVE;
 	_currTexture = _dicomVolumeTexture;	// raw dicom
+	macrocells.Init();
+	macrocells.SetMask(_dicomMaskTexture);
+	dynamicResolution.Init(_windowWidth, _windowHeight);
+	transferFunction.Init();
+	transferFunction.SetControlPoints(TransferFunction::GrayRamp(tfDensity));
 }
 
 void SceneManager::ClearScene() {
@@ -160,22 +204,52 @@ void SceneManager::ClearScene() {
 
 void SceneManager::Update() {
 
-	_camera->Update();
-
 	// Gets events, including input such as keyboard and mouse or window resizing
-	glfwPollEvents();
+	// - waits for one when redrawing on demand
+	if (redrawOnDemand) {
+		glfwWaitEvents();
+	}
+	else {
+		glfwPollEvents();
+	}
+
+	_camera->Update();
 }
 
 void SceneManager::Draw() {
 
+	// rebuild the pre-integrated table if the transfer function changed
+	transferFunction.Update();
+
+	// nothing changed -> show the last frame again
+	bool moving = LeftDown || RightDown;
+	FrameState frame = { _camera->GetViewProjectMtx(), _currTexture, _useMask, moving, usePreintegration, 
+		transferFunction.GetVersion(), _windowWidth, _windowHeight };
+	if (redrawOnDemand && lastFrameValid && frame == lastFrame) {
+		dynamicResolution.Present();
+		glfwSwapBuffers(_window);
+		return;
+	}
+	lastFrame = frame;
+	lastFrameValid = true;
+
+	macrocells.Update(_currTexture);
+
+	// draw the volume offscreen, at a lower resolution while the camera is being dragged
+	dynamicResolution.Begin(moving);
+
 	// Clear the color and depth buffers
 	glClearColor(0.52f, 0.81f, 0.92f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// draw the volume
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	_dicomCube->Draw(_volumeShader, _camera->GetViewProjectMtx(), _camera->GetCamPos(), _currTexture, _dicomMaskTexture, _useMask);
+	transferFunction.Bind(_volumeShader, 4, usePreintegration);
+	_dicomCube->Draw(_volumeShader, _camera->GetViewProjectMtx(), _camera->GetCamPos(), _currTexture, 
+		macrocells.GetOccupancyTexture(), _useMask, macrocells.GetTexture(), macrocells.GetMaskCellTexture());
+
+	// upsample to the window
+	dynamicResolution.End();
 
 	// Swap buffers
 	glfwSwapBuffers(_window);
@@ -203,6 +277,12 @@ void SceneManager::KeyCallback(GLFWwindow* window, int key, int scancode, int ac
 				_camera->Reset();
 				break;
 
+			// switch between redrawing on demand and every frame
+			case GLFW_KEY_V:
+				redrawOnDemand = !redrawOnDemand;
+				printf("Redraw: %s\n", redrawOnDemand ? "ON DEMAND" : "CONTINUOUS");
+				break;
+
 			// switch between the different types of CLAHE
 			case GLFW_KEY_D:
 				_textureMode = TextureMode::_RAW;
@@ -210,20 +290,61 @@ void SceneManager::KeyCallback(GLFWwindow* window, int key, int scancode, int ac
 				break;
 			case GLFW_KEY_C: // 3D CLAHE
 				_textureMode = TextureMode::_CLAHE;
+				if (_3D_CLAHE == 0) updateVolume();	// freed by a phase change
 				_currTexture = _3D_CLAHE;
 				break;
 			case GLFW_KEY_F: // Focused CLAHE
 				_textureMode = TextureMode::_FOCUSED;
+				if (_FocusedCLAHE == 0) updateVolume();
 				_currTexture = _FocusedCLAHE;
 				break;
 			case GLFW_KEY_M: // Masked CLAHE 
 				_textureMode = TextureMode::_MASKED;
+				if (_MaskedCLAHE == 0) updateVolume();
 				_currTexture = _MaskedCLAHE;
 				break;
 			case GLFW_KEY_O: // show just the organs
 				_useMask = !_useMask;
 				break;
 
+			// Transfer function
+			case GLFW_KEY_P: // pre-integrated classification
+				usePreintegration = !usePreintegration;
+				printf("Pre-integration: %s\n", usePreintegration ? "ON" : "OFF");
+				break;
+			case GLFW_KEY_LEFT_BRACKET:
+			case GLFW_KEY_RIGHT_BRACKET:
+				tfDensity = glm::clamp(tfDensity * (key == GLFW_KEY_RIGHT_BRACKET ? 1.25f : 0.8f), 0.01f, 1.0f);
+				printf("Opacity: %.3f\n", tfDensity);
+				transferFunction.SetControlPoints(TransferFunction::GrayRamp(tfDensity));
+				break;
+
+			// Step through the phases of a time series
+			case GLFW_KEY_T:
+				if (_dicomVolume->GetNumPhases() > 1) {
+					currPhase = (currPhase + 1) % _dicomVolume->GetNumPhases();
+					printf("Phase: %d\n", currPhase);
+
+					// free the CLAHE volumes of the old phase (a clip limit of 0 returns the volume itself)
+					for (GLuint* texture : { &_3D_CLAHE, &_FocusedCLAHE, &_MaskedCLAHE }) {
+						if (*texture != 0 && *texture != _dicomVolumeTexture) {
+							glDeleteTextures(1, texture);
+						}
+						*texture = 0;
+					}
+					_dicomVolumeTexture = _dicomVolume->GetPhaseTextureID(currPhase);
+					comp.SetVolumeTexture(_dicomVolumeTexture);
+
+					// only the mode being shown is recomputed, the others when they are selected
+					if (_textureMode == TextureMode::_RAW) {
+						_currTexture = _dicomVolumeTexture;
+					}
+					else {
+						updateVolume();
+					}
+				}
+				break;
+
 			// Change Interaction Mode for Focused CLAHE
 			case GLFW_KEY_B:
 				if (_textureMode == TextureMode::_FOCUSED) {
@@ -378,6 +499,7 @@ void SceneManager::ResizeCallback(GLFWwindow* window, int width, int height) {
 
 	// Set the viewport size
 	glViewport(0, 0, width, height);
+	dynamicResolution.Resize(width, height);
 
 	// Set the View and Projection Matrices
 	_camera->SetAspect(float(width) / float(height));
@@ -0,0 +1,105 @@
+////////////////////////////////////////
+// ThreadPool.cpp
+////////////////////////////////////////
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructor/Destructor
+
+ThreadPool::ThreadPool(unsigned int numThreads) {
+
+	if (numThreads == 0) {
+		numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	for (unsigned int i = 0; i < numThreads; i++) {
+		_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_taskReady.notify_all();
+
+	for (auto & currThread : _workers) {
+		currThread.join();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tasks
+
+void ThreadPool::Enqueue(std::function<void()> task) {
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_tasks.push(std::move(task));
+	}
+	_taskReady.notify_one();
+}
+
+void ThreadPool::Wait() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_tasksDone.wait(lock, [this]() { return _tasks.empty() && _numBusy == 0; });
+}
+
+void ThreadPool::ParallelFor(unsigned int count,
+		const std::function<void(unsigned int, unsigned int, unsigned int)>& func, unsigned int numChunks) {
+
+	if (count == 0) {
+		return;
+	}
+	if (numChunks == 0) {
+		numChunks = GetNumThreads();
+	}
+	numChunks = std::min(numChunks, count);
+
+	// each chunk processes chunkSize items, the last one may be smaller
+	unsigned int chunkSize = (count + numChunks - 1) / numChunks;
+	for (unsigned int chunk = 0; chunk < numChunks; chunk++) {
+		unsigned int begin = chunk * chunkSize;
+		unsigned int end = std::min(begin + chunkSize, count);
+		if (begin >= end) {
+			break;
+		}
+		Enqueue([&func, begin, end, chunk]() { func(begin, end, chunk); });
+	}
+	Wait();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Worker
+
+void ThreadPool::workerLoop() {
+
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_taskReady.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+			if (_stop && _tasks.empty()) {
+				return;
+			}
+			task = std::move(_tasks.front());
+			_tasks.pop();
+			_numBusy++;
+		}
+
+		task();
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_numBusy--;
+			if (_tasks.empty() && _numBusy == 0) {
+				_tasksDone.notify_all();
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
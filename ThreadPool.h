@@ -0,0 +1,47 @@
+////////////////////////////////////////
+// ThreadPool.h
+// Fixed set of worker threads shared by the host side CLAHE and loaders
+////////////////////////////////////////
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+	// Workers and the queue of tasks waiting for them
+	std::vector<std::thread> _workers;
+	std::queue<std::function<void()>> _tasks;
+
+	// Synchronization
+	std::mutex _mutex;
+	std::condition_variable _taskReady, _tasksDone;
+	unsigned int _numBusy = 0;
+	bool _stop = false;
+
+	void workerLoop();
+
+public:
+	// numThreads == 0 -> one worker per hardware thread
+	ThreadPool(unsigned int numThreads = 0);
+	~ThreadPool();
+
+	// Queue a single task / block until every queued task has finished
+	// Note: do not call Wait() from inside a task
+	void Enqueue(std::function<void()> task);
+	void Wait();
+
+	// Split [0, count) into numChunks contiguous ranges and run func(begin, end, chunk)
+	// on the workers, returns once all of the ranges are done
+	// numChunks == 0 -> one chunk per worker
+	void ParallelFor(unsigned int count, const std::function<void(unsigned int, unsigned int, unsigned int)>& func,
+					unsigned int numChunks = 0);
+
+	// Getters
+	unsigned int GetNumThreads()	{ return (unsigned int)_workers.size(); }
+};
@@ -0,0 +1,143 @@
+////////////////////////////////////////
+// TransferFunction.cpp
+////////////////////////////////////////
+
+#include "TransferFunction.h"
+#include "Shader.h"
+
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////
+// Constructor/Destructor
+
+void TransferFunction::Init(unsigned int tableSize) {
+
+	_preintegrateShader = LoadComputeShader("preintegrate.comp");
+	_tableSize = std::max(tableSize, 2u);
+
+	glGenTextures(1, &_transferTexture);
+	glBindTexture(GL_TEXTURE_1D, _transferTexture);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexStorage1D(GL_TEXTURE_1D, 1, GL_RGBA16F, _tableSize);
+	glBindTexture(GL_TEXTURE_1D, 0);
+
+	glGenTextures(1, &_preintegratedTexture);
+	glBindTexture(GL_TEXTURE_2D, _preintegratedTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, _tableSize, _tableSize);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (_points.empty()) {
+		_points = GrayRamp(0.1f);
+	}
+	_dirty = true;
+}
+
+TransferFunction::~TransferFunction() {
+	glDeleteProgram(_preintegrateShader);
+	GLuint textures[2] = { _transferTexture, _preintegratedTexture };
+	glDeleteTextures(2, textures);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Transfer Function
+
+void TransferFunction::SetControlPoints(const std::vector<ControlPoint>& points) {
+	_points = points;
+	std::stable_sort(_points.begin(), _points.end(), [](const ControlPoint& a, const ControlPoint& b) {
+		return a.value < b.value;
+		});
+	_dirty = true;
+}
+
+void TransferFunction::SetStepSize(float stepSize) {
+	_stepSize = stepSize;
+	_dirty = true;
+}
+
+void TransferFunction::Update() {
+	if (_dirty && _preintegrateShader != 0) {
+		rebuild();
+		_dirty = false;
+	}
+}
+
+void TransferFunction::Bind(GLuint shader, GLuint unit, bool usePreintegration) {
+
+	glUseProgram(shader);
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, _preintegratedTexture);
+	glUniform1i(glGetUniformLocation(shader, "Preintegrated"), unit);
+	glUniform1i(glGetUniformLocation(shader, "usePreintegration"), usePreintegration);
+	glUniform1f(glGetUniformLocation(shader, "PreintegratedStepSize"), _stepSize);
+	glUniform2f(glGetUniformLocation(shader, "VisibleRange"), _visibleRange.x, _visibleRange.y);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+std::vector<TransferFunction::ControlPoint> TransferFunction::GrayRamp(float density) {
+
+	// values under the .01 opacity cut of volume.frag are not drawn
+	float threshold = std::min(0.01f / std::max(density, 1e-5f), 1.0f);
+	return {
+		{ 0.0f,		 glm::vec4(0.0f) },
+		{ threshold, glm::vec4(glm::vec3(threshold), 0.0f) },
+		{ threshold, glm::vec4(glm::vec3(threshold), threshold * density) },
+		{ 1.0f,		 glm::vec4(glm::vec3(1.0f), density) }
+	};
+}
+
+// evaluates the control points into the 1D texture on the host, the (front, back) 
+// table is integrated on the GPU, one thread per entry
+void TransferFunction::rebuild() {
+
+	std::vector<glm::vec4> table(_tableSize, glm::vec4(0.0f));
+	_visibleRange = glm::vec2(1.0f, 0.0f);
+	for (unsigned int i = 0; i < _tableSize && !_points.empty(); i++) {
+		float value = (float)i / (float)(_tableSize - 1);
+
+		// first control point past the value, equal values make a hard edge
+		auto next = std::upper_bound(_points.begin(), _points.end(), value, [](float v, const ControlPoint& point) {
+			return v < point.value;
+			});
+		if (next == _points.begin()) {
+			table[i] = next->color;
+		}
+		else if (next == _points.end()) {
+			table[i] = _points.back().color;
+		}
+		else {
+			const ControlPoint& prev = *(next - 1);
+			float t = (value - prev.value) / std::max(next->value - prev.value, 1e-6f);
+			table[i] = glm::mix(prev.color, next->color, t);
+		}
+
+		if (table[i].a > 0.0f) {
+			_visibleRange.x = std::min(_visibleRange.x, value);
+			_visibleRange.y = std::max(_visibleRange.y, value);
+		}
+	}
+	// one entry of slack for the interpolation between entries
+	float entry = 1.0f / (float)(_tableSize - 1);
+	_visibleRange = glm::vec2(_visibleRange.x - entry, _visibleRange.y + entry);
+
+	glBindTexture(GL_TEXTURE_1D, _transferTexture);
+	glTexSubImage1D(GL_TEXTURE_1D, 0, 0, _tableSize, GL_RGBA, GL_FLOAT, table.data());
+	glBindTexture(GL_TEXTURE_1D, 0);
+
+	glUseProgram(_preintegrateShader);
+	glBindImageTexture(0, _transferTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, _preintegratedTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glUniform1f(glGetUniformLocation(_preintegrateShader, "stepSize"), _stepSize);
+	glUniform1f(glGetUniformLocation(_preintegrateShader, "referenceStep"), _referenceStep);
+
+	glDispatchCompute((_tableSize + 15) / 16, (_tableSize + 15) / 16, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	glUseProgram(0);
+
+	_version++;
+}
@@ -0,0 +1,62 @@
+////////////////////////////////////////
+// TransferFunction.h
+// 1D transfer function and its pre-integrated lookup table for the raymarcher
+////////////////////////////////////////
+
+#pragma once
+
+#include "core.h"
+
+#include <vector>
+
+class TransferFunction {
+public:
+
+	// value in [0,1], rgb color and opacity per reference step
+	struct ControlPoint {
+		float value;
+		glm::vec4 color;
+	};
+
+private:
+
+	GLuint _preintegrateShader = 0;
+	GLuint _transferTexture = 0;		// RGBA16F 1D transfer function
+	GLuint _preintegratedTexture = 0;	// RGBA16F (front, back) lookup table
+	unsigned int _tableSize = 256;
+
+	std::vector<ControlPoint> _points;
+	float _stepSize = 0.008f;			// segment length the table is integrated for
+	float _referenceStep = 0.002f;		// segment length the opacities are defined for
+	glm::vec2 _visibleRange = glm::vec2(0.0f, 1.0f);
+	bool _dirty = true;
+	unsigned int _version = 0;			// incremented every rebuild
+
+	void rebuild();
+
+public:
+	TransferFunction() {};
+	~TransferFunction();
+
+	void Init(unsigned int tableSize = 256);
+
+	// Control points sorted by value, the table is rebuilt on the next Update
+	void SetControlPoints(const std::vector<ControlPoint>& points);
+	void SetStepSize(float stepSize);
+	// Rebuilds the pre-integrated table on the GPU if anything changed
+	void Update();
+
+	// Sets the transfer function uniforms and binds the table to the texture unit
+	void Bind(GLuint shader, GLuint unit, bool usePreintegration);
+
+	// Gray ramp with opacity = value * density, the classification volume.frag uses
+	// without a transfer function
+	static std::vector<ControlPoint> GrayRamp(float density);
+
+	// Getters
+	GLuint GetTexture()						{ return _transferTexture; }
+	GLuint GetPreintegratedTexture()		{ return _preintegratedTexture; }
+	float GetStepSize()						{ return _stepSize; }
+	glm::vec2 GetVisibleRange()				{ return _visibleRange; }
+	unsigned int GetVersion()				{ return _version; }
+};
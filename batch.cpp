@@ -0,0 +1,451 @@
+////////////////////////////////////////
+// batch.cpp
+// Headless CLAHE - loads a DICOM folder, applies CLAHE and writes a MetaImage
+////////////////////////////////////////
+
+#include <GL/glew.h>
+#ifdef CLAHE_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#include <GLFW/glfw3.h>
+#endif
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+
+#include "ImageLoader.h"
+#include "ComputeCLAHE.h"
+#include "ComputeCLAHE_CPU.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// Options
+
+enum class Mode {
+	_CLAHE,
+	_FOCUSED,
+	_MASKED
+};
+
+struct Options {
+	string input, output, mask;
+	Mode mode = Mode::_CLAHE;
+	glm::uvec3 numSB = glm::uvec3(4, 4, 2);
+	glm::ivec3 min = glm::ivec3(200, 200, 40);
+	glm::ivec3 max = glm::ivec3(400, 400, 90);
+	float clipLimit = 0.85f;
+	unsigned int maxBins = 4096;
+	unsigned int numOrgans = 4;
+	bool useCPU = false;
+	unsigned int numThreads = 0;
+	bool useCache = true;
+};
+
+void printUsage() {
+	printf("usage: clahe_batch <DICOM folder> <output.mhd> [options]\n"
+		"  --mode clahe|focused|masked  CLAHE variant to run (default clahe)\n"
+		"  --numSB x y z                number of Sub Blocks (default 4 4 2)\n"
+		"  --clip c                     clipLimit in [0,1] (default 0.85)\n"
+		"  --bins n                     max number of output gray values (default 4096)\n"
+		"  --min x y z / --max x y z    Focused CLAHE region\n"
+		"  --mask folder                mask images for Masked CLAHE\n"
+		"  --organs n                   number of organs in the mask (default 4)\n"
+		"  --cpu                        use the CPU engine (3D CLAHE only, no GL context)\n"
+		"  --threads n                  CPU CLAHE and DICOM decode threads (default: all hardware threads)\n"
+		"  --no-cache                   do not read or write the <folder>.clahe volume cache\n");
+}
+
+bool parseArgs(int argc, char** argv, Options& opt) {
+
+	if (argc < 3) {
+		return false;
+	}
+	opt.input = argv[1];
+	opt.output = argv[2];
+
+	for (int i = 3; i < argc; i++) {
+		string arg = argv[i];
+		int remaining = argc - i - 1;
+
+		if (arg == "--mode" && remaining >= 1) {
+			string mode = argv[++i];
+			if (mode == "clahe")            opt.mode = Mode::_CLAHE;
+			else if (mode == "focused")     opt.mode = Mode::_FOCUSED;
+			else if (mode == "masked")      opt.mode = Mode::_MASKED;
+			else {
+				fprintf(stderr, "Unknown mode: %s\n", mode.c_str());
+				return false;
+			}
+		}
+		else if (arg == "--numSB" && remaining >= 3) {
+			opt.numSB = glm::uvec3(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+			i += 3;
+		}
+		else if (arg == "--min" && remaining >= 3) {
+			opt.min = glm::ivec3(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+			i += 3;
+		}
+		else if (arg == "--max" && remaining >= 3) {
+			opt.max = glm::ivec3(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+			i += 3;
+		}
+		else if (arg == "--clip" && remaining >= 1)     opt.clipLimit = (float)atof(argv[++i]);
+		else if (arg == "--bins" && remaining >= 1)     opt.maxBins = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--mask" && remaining >= 1)     opt.mask = argv[++i];
+		else if (arg == "--organs" && remaining >= 1)   opt.numOrgans = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--threads" && remaining >= 1)  opt.numThreads = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--cpu")                        opt.useCPU = true;
+		else if (arg == "--no-cache")                   opt.useCache = false;
+		else {
+			fprintf(stderr, "Unknown or incomplete option: %s\n", arg.c_str());
+			return false;
+		}
+	}
+
+	if (glm::any(glm::equal(opt.numSB, glm::uvec3(0)))) {
+		fprintf(stderr, "numSB must be at least 1 in every dimension\n");
+		return false;
+	}
+	if (opt.maxBins == 0 || opt.numOrgans == 0) {
+		fprintf(stderr, "--bins and --organs must be at least 1\n");
+		return false;
+	}
+	if (opt.useCPU && opt.mode != Mode::_CLAHE) {
+		fprintf(stderr, "The CPU engine only supports 3D CLAHE\n");
+		return false;
+	}
+	if (opt.mode == Mode::_MASKED && opt.mask.empty()) {
+		fprintf(stderr, "Masked CLAHE needs --mask\n");
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Headless OpenGL Context
+
+#ifdef CLAHE_USE_EGL
+EGLDisplay _display = EGL_NO_DISPLAY;
+EGLContext _context = EGL_NO_CONTEXT;
+
+// surfaceless EGL context, works without a display server (ie. Mesa llvmpipe)
+bool createContext() {
+
+	// prefer the surfaceless platform, fall back to the default display
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay) {
+		_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+	if (_display == EGL_NO_DISPLAY) {
+		_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	EGLint major, minor;
+	if (_display == EGL_NO_DISPLAY || !eglInitialize(_display, &major, &minor)) {
+		fprintf(stderr, "Failed to initialize EGL\n");
+		return false;
+	}
+	printf("EGL Version: %d.%d\n", major, minor);
+
+	const EGLint configAttribs[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglChooseConfig(_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+		fprintf(stderr, "Failed to find an EGL config\n");
+		return false;
+	}
+
+	eglBindAPI(EGL_OPENGL_API);
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 4,
+		EGL_NONE
+	};
+	_context = eglCreateContext(_display, config, EGL_NO_CONTEXT, contextAttribs);
+	if (_context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Failed to create an OpenGL 4.4 context\n");
+		return false;
+	}
+
+	// no surface, the CLAHE volumes are only written to textures
+	if (!eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, _context)) {
+		fprintf(stderr, "Failed to make the EGL context current\n");
+		return false;
+	}
+	return true;
+}
+
+void destroyContext() {
+	if (_display == EGL_NO_DISPLAY) return;
+
+	eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (_context != EGL_NO_CONTEXT) {
+		eglDestroyContext(_display, _context);
+	}
+	eglTerminate(_display);
+}
+#else
+GLFWwindow* _window = nullptr;
+
+// hidden GLFW window for platforms without EGL
+bool createContext() {
+
+	if (!glfwInit()) {
+		fprintf(stderr, "Failed to initialize GLFW\n");
+		return false;
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	_window = glfwCreateWindow(1, 1, "CLAHE", nullptr, nullptr);
+	if (!_window) {
+		fprintf(stderr, "Failed to create an OpenGL 4.4 context\n");
+		glfwTerminate();
+		return false;
+	}
+
+	glfwMakeContextCurrent(_window);
+	return true;
+}
+
+void destroyContext() {
+	if (_window) {
+		glfwDestroyWindow(_window);
+	}
+	glfwTerminate();
+}
+#endif
+
+bool initGLEW() {
+
+	glewExperimental = GL_TRUE;
+	GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// GLX GLEW builds report this without an X display, the GL entry points are still loaded
+	if (err == GLEW_ERROR_NO_GLX_DISPLAY) {
+		err = GLEW_OK;
+	}
+#endif
+	if (err != GLEW_OK) {
+		fprintf(stderr, "Failed to initialize GLEW!\n");
+		return false;
+	}
+
+	if (const GLubyte* renderer = glGetString(GL_RENDERER))
+		printf("OpenGL Renderer: %s\n", renderer);
+	if (const GLubyte* version = glGetString(GL_VERSION))
+		printf("OpenGL Version: %s\n", version);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Output
+
+// reads back the R16F CLAHE texture as normalized floats
+float* readTexture(GLuint texture, glm::uvec3 volDims) {
+
+	float* data = new float[(size_t)volDims.x * volDims.y * volDims.z];
+
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, data);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	return data;
+}
+
+// writes the volume as a MetaImage header (.mhd) and a raw float file (.raw)
+bool writeMetaImage(const string& path, const float* data, glm::uvec3 volDims, glm::vec3 spacing) {
+
+	string base = path;
+	size_t ext = base.rfind(".mhd");
+	if (ext != string::npos) {
+		base = base.substr(0, ext);
+	}
+	string rawPath = base + ".raw";
+	size_t slash = rawPath.find_last_of("/\\");
+	string rawName = (slash == string::npos) ? rawPath : rawPath.substr(slash + 1);
+
+	FILE* header = fopen((base + ".mhd").c_str(), "w");
+	if (!header) {
+		fprintf(stderr, "Failed to open %s.mhd\n", base.c_str());
+		return false;
+	}
+	fprintf(header, "ObjectType = Image\n");
+	fprintf(header, "NDims = 3\n");
+	fprintf(header, "BinaryData = True\n");
+	fprintf(header, "BinaryDataByteOrderMSB = False\n");
+	fprintf(header, "DimSize = %u %u %u\n", volDims.x, volDims.y, volDims.z);
+	fprintf(header, "ElementSpacing = %f %f %f\n", spacing.x, spacing.y, spacing.z);
+	fprintf(header, "ElementType = MET_FLOAT\n");
+	fprintf(header, "ElementDataFile = %s\n", rawName.c_str());
+	fclose(header);
+
+	FILE* raw = fopen(rawPath.c_str(), "wb");
+	if (!raw) {
+		fprintf(stderr, "Failed to open %s\n", rawPath.c_str());
+		return false;
+	}
+	size_t count = (size_t)volDims.x * volDims.y * volDims.z;
+	bool ok = fwrite(data, sizeof(float), count, raw) == count;
+	fclose(raw);
+
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s\n", rawPath.c_str());
+	}
+	return ok;
+}
+
+// <output>_p<phase>.mhd for time series, the output path as given otherwise
+string phaseOutputPath(const string& path, unsigned int phase, unsigned int numPhases) {
+
+	if (numPhases <= 1) {
+		return path;
+	}
+	string base = path;
+	size_t ext = base.rfind(".mhd");
+	if (ext != string::npos) {
+		base = base.substr(0, ext);
+	}
+	return base + "_p" + to_string(phase) + ".mhd";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CLAHE
+
+// runs the requested CLAHE variant on the GPU, returns the result as a host buffer
+// - comp is created once, each phase only switches its volume texture
+float* runGPU(const Options& opt, ComputeCLAHE& comp, ImageLoader& volume, unsigned int phase) {
+
+	glm::uvec3 volDims = volume.GetImageDimensions();
+	GLuint volumeTexture = volume.GetPhaseTextureID(phase);
+	comp.SetVolumeTexture(volumeTexture);
+
+	GLuint result = 0;
+	switch (opt.mode) {
+	case Mode::_CLAHE:
+		result = comp.Compute3D_CLAHE(opt.numSB, opt.clipLimit);
+		break;
+	case Mode::_FOCUSED:
+		result = comp.ComputeFocused3D_CLAHE(opt.min, opt.max, opt.clipLimit);
+		break;
+	case Mode::_MASKED:
+		result = comp.ComputeMasked3D_CLAHE(opt.clipLimit);
+		break;
+	}
+	if (result == 0) {
+		return nullptr;
+	}
+
+	float* data = readTexture(result, volDims);
+	if (result != volumeTexture) {
+		glDeleteTextures(1, &result);
+	}
+	return data;
+}
+
+float* runCPU(const Options& opt, ImageLoader& volume, unsigned int phase, unsigned int numBins) {
+
+	ComputeCLAHE_CPU comp(volume.GetImageData(phase), volume.GetImageDimensions(), numBins, 65536, opt.numThreads);
+	return comp.Compute3D_CLAHE(opt.numSB, opt.clipLimit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+
+int main(int argc, char** argv) {
+
+	Options opt;
+	if (!parseArgs(argc, argv, opt)) {
+		printUsage();
+		return 1;
+	}
+
+	if (!opt.useCPU && (!createContext() || !initGLEW())) {
+		return 1;
+	}
+
+	auto start = chrono::high_resolution_clock::now();
+	int status = 0;
+	{
+		// the CPU engine only needs the host copy of the volume
+		string maskPath = (opt.mode == Mode::_MASKED) ? opt.mask : string("");
+		ImageLoader::SetUseCache(opt.useCache);
+		ImageLoader::SetNumThreads(opt.numThreads);
+		ImageLoader volume(opt.input, maskPath, false, !opt.useCPU);
+		glm::uvec3 volDims = volume.GetImageDimensions();
+
+		bool loaded = opt.useCPU ? (volume.GetImageData() != nullptr) : (volume.GetTextureID() != 0);
+		if (!loaded || volDims.x * volDims.y * volDims.z == 0) {
+			fprintf(stderr, "Failed to load %s\n", opt.input.c_str());
+			status = 1;
+		}
+		// every Sub Block needs at least one voxel per dimension
+		else if (opt.mode == Mode::_CLAHE && glm::any(glm::greaterThan(opt.numSB, volDims))) {
+			fprintf(stderr, "numSB (%d, %d, %d) is larger than the volume (%d, %d, %d)\n", opt.numSB.x, opt.numSB.y, opt.numSB.z, 
+				volDims.x, volDims.y, volDims.z);
+			status = 1;
+		}
+		else {
+			// the GPU only needs the texture
+			if (!opt.useCPU) {
+				volume.ReleaseImageData();
+			}
+
+			unsigned int numBins = ComputeCLAHE::GetNumBins(volume.GetBitsStored(),
+				volume.GetMinPixelValue(), volume.GetMaxPixelValue(), opt.maxBins);
+			printf("Histogram bins: %d\n", numBins);
+
+			// voxel spacing in mm
+			glm::vec3 spacing = 1000.0f * volume.GetSize() / glm::vec3(volDims);
+
+			// the shaders are compiled once for every phase
+			ComputeCLAHE* comp = nullptr;
+			if (!opt.useCPU) {
+				comp = new ComputeCLAHE(volume.GetTextureID(), volume.GetMaskID(), volDims, numBins, 65536, opt.numOrgans);
+			}
+
+			// time series -> one output per phase
+			unsigned int numPhases = volume.GetNumPhases();
+			for (unsigned int phase = 0; phase < numPhases; phase++) {
+				float* data = opt.useCPU ? runCPU(opt, volume, phase, numBins) : runGPU(opt, *comp, volume, phase);
+
+				string output = phaseOutputPath(opt.output, phase, numPhases);
+				if (!data || !writeMetaImage(output, data, volDims, spacing)) {
+					status = 1;
+				}
+				delete[] data;
+			}
+			delete comp;
+			printf("Peak RSS: %.1f MB\n", ImageLoader::GetPeakRSS() / 1048576.0);
+		}
+
+		if (!opt.useCPU) {
+			for (unsigned int phase = 0; phase < volume.GetNumPhases(); phase++) {
+				GLuint texture = volume.GetPhaseTextureID(phase);
+				glDeleteTextures(1, &texture);
+			}
+			GLuint mask = volume.GetMaskID();
+			glDeleteTextures(1, &mask);
+		}
+	}
+
+	auto end = chrono::high_resolution_clock::now();
+	printf("clahe_batch took %.3fs\n", chrono::duration<double>(end - start).count());
+
+	if (!opt.useCPU) {
+		destroyContext();
+	}
+	return status;
+}
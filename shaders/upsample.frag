@@ -0,0 +1,23 @@
+////////////////////////////////////////
+// upsample.frag 
+// when used with display.vert stretches the low resolution volume rendering over 
+// the window with bilinear filtering
+////////////////////////////////////////
+
+#version 440 core
+
+layout (binding = 0) uniform sampler2D renderTexture;
+
+uniform vec2 uvScale;	// part of the texture that was rendered to
+
+in VertexData {
+	vec2 uv;
+} inData;
+
+out vec4 FragColor;
+
+void main() {
+	// stay half a texel inside the rendered part so filtering never reads past it
+	vec2 maxUV = uvScale - 0.5 / vec2(textureSize(renderTexture, 0));
+	FragColor = texture(renderTexture, min(inData.uv * uvScale, maxUV));
+}
@@ -22,7 +22,20 @@ uniform vec3 CameraPosition;
 // Volume and mask Textures 
 uniform sampler3D Volume;
 uniform int useMask;
-layout(r8ui, binding = 1) uniform uimage3D Mask;
+uniform sampler3D Occupancy;	// 1 inside the organs of the mask, 0 outside
+
+// min/max of the volume and occupancy per macrocell, cells too faint to draw or
+// without any organ (when masked) are skipped
+uniform sampler3D Macrocells;
+uniform sampler3D MaskCells;
+uniform int useMacrocells;
+
+// pre-integrated transfer function, premultiplied color and opacity of a ray segment
+// of PreintegratedStepSize from value (front, back)
+uniform sampler2D Preintegrated;
+uniform int usePreintegration;
+uniform float PreintegratedStepSize = .008;
+uniform vec2 VisibleRange;		// values outside have no opacity in the transfer function
 
 ////////////////////////////////////////////////////////////////////////////////
 // Helper functions
@@ -44,13 +57,10 @@ vec4 Sample(vec3 samplePoint) {
 	vec4 colorSample = textureLod(Volume, samplePoint, 0.0).rrrr;
 
 	if (useMask == 1) {
-//		float maskVal = textureLod(Mask, samplePoint, 0.0).x;
-		ivec3 dims = imageSize(Mask);
-		ivec3 samplePt = ivec3(samplePoint * dims);
-//		samplePt.x = dims.x - samplePt.x;
-		uint maskVal = imageLoad(Mask, samplePt).x;
-		if (maskVal == 0.0) {
-			colorSample.a = maskVal;
+		// filtered occupancy, less than half -> outside the organs
+		float maskVal = textureLod(Occupancy, samplePoint, 0.0).r;
+		if (maskVal < 0.5) {
+			colorSample.a = 0.0;
 		}
 	}
 //	colorSample.a = max(0.0, (colorSample.a - Threshold) / (1.0 - Threshold)); // subtractive for soft edges
@@ -60,6 +70,61 @@ vec4 Sample(vec3 samplePoint) {
 }
 
 
+// true if nothing in the macrocell at point can be seen
+bool EmptyCell(vec3 point, vec3 numCells, out ivec3 cell) {
+	cell = clamp(ivec3(point * numCells), ivec3(0), ivec3(numCells) - 1);
+	vec2 minMax = texelFetch(Macrocells, cell, 0).rg;
+	bool empty = (usePreintegration == 1) ? (minMax.g < VisibleRange.x || minMax.r > VisibleRange.y) 
+										  : (minMax.g * Density <= .01);
+	if (useMask == 1) {
+		empty = empty || texelFetch(MaskCells, cell, 0).g < 0.5;
+	}
+	return empty;
+}
+// distance along the ray where it leaves the macrocell
+float CellExit(vec3 rayOrigin, vec3 rayDirection, ivec3 cell, vec3 numCells) {
+	vec3 cellCenter = (vec3(cell) + .5) / numCells;
+	return RayCube(rayOrigin - cellCenter, rayDirection, .5 / numCells).y;
+}
+
+// front to back compositing of pre-integrated segments, the lookup accounts for 
+// everything between two samples so the step can be much larger
+vec4 MarchPreintegrated(vec3 rayOrigin, vec3 rayDirection, vec2 intersect) {
+
+	vec4 sum = vec4(0);
+	vec3 numCells = vec3(textureSize(Macrocells, 0));
+	float tableSize = float(textureSize(Preintegrated, 0).x);
+
+	uint steps = 0;
+	float front = textureLod(Volume, rayOrigin + rayDirection * intersect.x, 0.0).r;
+	for (float t = intersect.x; t < intersect.y;) {
+		if (sum.a > .98 || steps > 750) break;
+
+		vec3 point = rayOrigin + rayDirection * t;
+
+		// empty macrocell -> jump to where the ray leaves it
+		ivec3 cell;
+		if (useMacrocells == 1 && EmptyCell(point, numCells, cell)) {
+			t = max(t, CellExit(rayOrigin, rayDirection, cell, numCells)) + 1e-4;
+			front = textureLod(Volume, rayOrigin + rayDirection * t, 0.0).r;
+			continue;
+		}
+
+		float back = textureLod(Volume, point + rayDirection * PreintegratedStepSize, 0.0).r;
+		vec2 lookup = (vec2(front, back) * (tableSize - 1.0) + .5) / tableSize;
+		vec4 color = textureLod(Preintegrated, lookup, 0.0);
+		if (useMask == 1 && textureLod(Occupancy, point, 0.0).r < 0.5) {
+			color = vec4(0);
+		}
+		sum += color * (1 - sum.a);
+
+		steps++;
+		front = back;
+		t += PreintegratedStepSize;
+	}
+	return sum;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Main
 void main() {
@@ -71,14 +136,31 @@ void main() {
 	
 	rayOrigin += .5; // cube has a radius of .5, transform to UVW space
 
+	if (usePreintegration == 1) {
+		vec4 sum = MarchPreintegrated(rayOrigin, rayDirection, intersect);
+		sum.a = clamp(sum.a, 0.0, 1.0);
+		FragColor = sum;
+		return;
+	}
+
 	vec4 sum = vec4(0);
 
 	uint steps = 0;
 	float prevDensity = 0;
+	vec3 numCells = vec3(textureSize(Macrocells, 0));
 	for (float t = intersect.x; t < intersect.y;) {
 		if (sum.a > .98 || steps > 750) break;
 
 		vec3 point = rayOrigin + rayDirection * t;
+
+		// empty macrocell -> jump to where the ray leaves it
+		ivec3 cell;
+		if (useMacrocells == 1 && EmptyCell(point, numCells, cell)) {
+			t = max(t, CellExit(rayOrigin, rayDirection, cell, numCells)) + 1e-4;
+			prevDensity = 0;
+			continue;
+		}
+
 		vec4 color = Sample(point);
 
 		if (color.a > .01){